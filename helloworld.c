@@ -1,5 +1,6 @@
 #include "stdbool.h"
 #include "stdint.h"
+#include "stddef.h"
 
 #define portA *(unsigned volatile*)0x40000000
 #define LED *(unsigned volatile*)0x40000008
@@ -22,6 +23,9 @@
 
 
 #define SW *(unsigned volatile*)0x40010000
+#define sw_telemetry_offset 0b01
+#define sw_low_power_offset 0b10
+#define sw_stream_offset 0b100
 
 // seven segment display (SSD) signals
     // HEX data, 0xFEEF will show FEEF on SSD
@@ -41,8 +45,41 @@
     // segment symbol i, where i is the bit being set to 1.
 #define SSD_MODE_DP *(unsigned volatile*)0x44a5000C
 
+// number of frequencies the coils are excited at. with more than one, the excitation block
+// drives the coils at the frequency written to EXCITE_SEL and the firmware steps through them
+// one main loop cycle at a time. the default design has a single fixed frequency and no
+// excitation block, so EXCITE_SEL is only touched when this is raised.
+#ifndef NUM_EXCITE_FREQS
+#define NUM_EXCITE_FREQS 1
+#endif
+
+#define EXCITE_SEL *(unsigned volatile*)0x44A30000
+
+#ifdef HOST_SIM
+// host simulator build, host_hw.h swaps the registers above for the models in host_hw.c
+#include "host_hw.h"
+#endif
+
 #include "xil_printf.h"
 
+// define LOW_POWER_SLEEP when the timer's done signal is wired to the MicroBlaze Wakeup input
+// and the core is built with sleep support, so the core sleeps instead of polling the timer.
+// without that wiring a sleeping core would never wake up, so it is off by default.
+
+void wait_for_tick(void)
+{
+	// waits until the timer started by the last write to timer_dur has run out
+    while( (timer_state & 0b1) == 0)
+    {
+#ifdef LOW_POWER_SLEEP
+        // mbar 16 puts the MicroBlaze to sleep until the next wakeup event
+        __asm__ volatile ("mbar 16");
+#endif
+    }
+
+    return;
+} // end of wait_for_tick
+
 // generic delay function for use in some functions where the
 // addition of calling and returning to the function does not matter.
 void delay_n_secs(uint8_t seconds)
@@ -51,7 +88,7 @@ void delay_n_secs(uint8_t seconds)
     timer_dur = 100 * 1000 * 1000 * seconds;
 
     // waiting until timer_counter has incremented appropriately
-    while( (timer_state & 0b1) == 0){}
+    wait_for_tick();
 
     return;
 } // end of delay_n_secs
@@ -64,12 +101,270 @@ void delay_n_msecs(uint16_t millis)
     timer_dur = 100 * 1000 * millis;
 
     // waiting until timer_counter has incremented appropriately
-    while( (timer_state & 0b1) == 0){}
+    wait_for_tick();
 
     return;
 } // end of delay_n_msecs
 
-void printSSD(_Bool is_hex, uint32_t whole_vector, uint8_t dp_vector)
+// main loop timing. the timer is re-armed the moment it runs out, before any of the next
+// cycle's work, so every tick is exactly one period after the one before no matter how long
+// that work takes. filters that depend on the sample rate can count on loop_ms per tick.
+struct tick_state
+{
+    uint32_t period;        // timer cycles per tick
+    uint32_t ticks;         // ticks since the main loop started, missed ones included
+    uint32_t missed;        // deadlines that had already passed when the loop got to them
+    uint32_t resyncs;       // times the tick was restarted after the timer was borrowed
+    _Bool shed;             // the last deadline was missed, optional work is skipped this cycle
+    uint32_t slack_min;     // polls spent waiting for each tick, over the current report window
+    uint32_t slack_max;
+    uint32_t slack_sum;
+    uint16_t slack_count;
+    uint32_t armed;         // timer cycles the running tick was armed with
+    uint32_t last_polls;    // polls spent waiting for the last tick, 0 when its deadline was missed
+    uint32_t last_period;   // timer cycles the last tick was armed with
+    uint32_t elapsed;       // timer cycles gone by that tick_take_ms() has not handed out yet
+};
+
+void tick_stats_reset(struct tick_state* p_tick)
+{
+	// starts a new jitter report window
+    p_tick->slack_min = UINT32_MAX;
+    p_tick->slack_max = 0;
+    p_tick->slack_sum = 0;
+    p_tick->slack_count = 0;
+
+    return;
+} // end of tick_stats_reset
+
+void tick_start(struct tick_state* p_tick, uint16_t period_ms)
+{
+	// arms the first tick, the main loop then calls tick_wait() once per cycle
+    p_tick->period = 100 * 1000 * period_ms;
+    p_tick->ticks = 0;
+    p_tick->missed = 0;
+    p_tick->resyncs = 0;
+    p_tick->shed = false;
+    p_tick->last_polls = 0;
+    p_tick->last_period = p_tick->period;
+    p_tick->armed = p_tick->period;
+    p_tick->elapsed = 0;
+    tick_stats_reset(p_tick);
+
+    timer_dur = p_tick->period;
+
+    return;
+} // end of tick_start
+
+void tick_set_period(struct tick_state* p_tick, uint16_t period_ms)
+{
+	// a new period, used from the next time the timer is re-armed
+    p_tick->period = 100 * 1000 * period_ms;
+
+    return;
+} // end of tick_set_period
+
+void tick_wait(struct tick_state* p_tick)
+{
+	// waits for the next deadline and re-arms the timer straight away for the one after.
+	// when the deadline has already passed the cycle overran. there is no way to tell by how
+	// much, so rather than running cycles back to back to catch up, the tick restarts from
+	// now and shed is set so the next cycle can skip optional work and get back on time.
+	// either way the time the tick was armed for has gone by, an overrun from the loop's own
+	// work is the one thing elapsed cannot count.
+    // the check below is the first poll
+    uint32_t polls = 1;
+
+    p_tick->elapsed += p_tick->armed;
+
+    if (timer_state & 0b1)
+    {
+        timer_dur = p_tick->period;
+        p_tick->last_polls = 0;
+        p_tick->last_period = p_tick->armed;
+        p_tick->armed = p_tick->period;
+        p_tick->ticks++;
+        p_tick->missed++;
+        p_tick->shed = true;
+        return;
+    }
+
+    while ((timer_state & 0b1) == 0)
+    {
+        polls++;
+#ifdef LOW_POWER_SLEEP
+        // mbar 16 puts the MicroBlaze to sleep until the next wakeup event
+        __asm__ volatile ("mbar 16");
+#endif
+    }
+    timer_dur = p_tick->period;
+    p_tick->last_polls = polls;
+    p_tick->last_period = p_tick->armed;
+    p_tick->armed = p_tick->period;
+
+    p_tick->ticks++;
+    p_tick->shed = false;
+
+    p_tick->slack_min = (polls < p_tick->slack_min) ? polls : p_tick->slack_min;
+    p_tick->slack_max = (polls > p_tick->slack_max) ? polls : p_tick->slack_max;
+    p_tick->slack_sum += polls;
+    p_tick->slack_count++;
+
+    return;
+} // end of tick_wait
+
+void tick_borrow(struct tick_state* p_tick)
+{
+	// hands the timer over for a while, see tick_resync(). the running tick is waited out
+	// first, so the hand over happens a known time after the last tick and none of the cycle
+	// goes uncounted. a tick that has already run out was missed.
+    if (timer_state & 0b1)
+    {
+        p_tick->missed++;
+    }
+    wait_for_tick();
+
+    p_tick->elapsed += p_tick->armed;
+    p_tick->ticks++;
+
+    return;
+} // end of tick_borrow
+
+void tick_resync(struct tick_state* p_tick, uint32_t borrowed)
+{
+	// restarts the tick after the timer was borrowed for borrowed timer cycles, counted apart
+	// from missed deadlines
+    timer_dur = p_tick->period;
+    p_tick->armed = p_tick->period;
+    p_tick->elapsed += borrowed;
+    p_tick->resyncs++;
+
+    return;
+} // end of tick_resync
+
+uint32_t tick_take_ms(struct tick_state* p_tick)
+{
+	// whole mS gone by since the last call, from every tick, missed ones included, and the time
+	// the timer was borrowed for. the part of a mS left over is kept for the next call.
+    uint32_t millis = p_tick->elapsed / (100 * 1000);
+
+    p_tick->elapsed -= millis * 100 * 1000;
+
+    return millis;
+} // end of tick_take_ms
+
+// a pair of ADC readings in mV, taken as close together as the XADC allows, see read_adc_frame()
+struct adc_frame
+{
+    uint16_t adc1;
+    uint16_t adc2;
+};
+
+// signed Q23.8 fixed point, 256 is 1 mV. detection arithmetic is done in this type so that
+// differences between readings, baselines and thresholds go negative instead of wrapping.
+typedef int32_t q8_t;
+
+#define q8_from_mv(mv) ((q8_t)(mv) * 256)
+
+static inline q8_t q8_add(q8_t a, q8_t b)
+{
+	// saturating add. the sum overflowed when both inputs have the same sign and the result's
+	// sign differs, in which case it is clamped to INT32_MAX or INT32_MIN without branching.
+    uint32_t ua = a;
+    uint32_t ub = b;
+    uint32_t sum = ua + ub;
+    uint32_t overflow = 0u - (((ua ^ sum) & (ub ^ sum)) >> 31);
+    uint32_t saturated = (ua >> 31) + (uint32_t)INT32_MAX;
+
+    return (q8_t)((sum & ~overflow) | (saturated & overflow));
+} // end of q8_add
+
+static inline q8_t q8_sub(q8_t a, q8_t b)
+{
+	// saturating subtract. the difference overflowed when the inputs have different signs and
+	// the result's sign differs from a's.
+    uint32_t ua = a;
+    uint32_t ub = b;
+    uint32_t diff = ua - ub;
+    uint32_t overflow = 0u - (((ua ^ ub) & (ua ^ diff)) >> 31);
+    uint32_t saturated = (ua >> 31) + (uint32_t)INT32_MAX;
+
+    return (q8_t)((diff & ~overflow) | (saturated & overflow));
+} // end of q8_sub
+
+static inline int32_t q8_gt(q8_t a, q8_t b)
+{
+	// 1 when a > b, 0 otherwise. b - a saturates instead of wrapping, so its sign bit is the answer.
+    return (uint32_t)q8_sub(b, a) >> 31;
+} // end of q8_gt
+
+static inline q8_t q8_max0(q8_t a)
+{
+	// clamps negative values to 0
+    return a & ~(q8_t)(0u - ((uint32_t)a >> 31));
+} // end of q8_max0
+
+// every setting that can be changed at runtime through the menu, all values are
+// kept as uint16_t so the menu can edit any of them the same way.
+struct detector_params
+{
+    uint16_t threshold_adc1;    // drop in mV below calibration for metal to be detected
+    uint16_t threshold_adc2;
+    uint16_t close_adc1;        // drop in mV below calibration for metal to be considered close
+    uint16_t close_adc2;
+    uint16_t deadzone;          // hysteresis in mV around every threshold
+    uint16_t pos_alpha;         // Q8 gains of the alpha-beta position filter
+    uint16_t pos_beta;
+    uint16_t loop_ms;           // main loop period in mS, this is the sample rate
+    uint16_t gnd_mode;          // ground balance, 0 off, 1 manual, 2 automatic tracking
+    uint16_t gnd_offset_adc1;   // ground drop in mV taken off each channel in manual mode
+    uint16_t gnd_offset_adc2;
+    uint16_t gnd_track;         // automatic tracking follows the ground over 2^gnd_track main loop cycles
+    uint16_t cfar;              // 1 for thresholds that follow the noise, see cfar_update()
+};
+
+// default thresholds for seeing metal and close metal, deadzone, position filter gains and a 20 mS loop,
+// all of these can be changed from the menu while the detector is running.
+// ground balance starts off, with no offsets and a tracking time constant of 2^8 cycles.
+// CFAR starts off, when it is turned on the thresholds and deadzone become noise multiples in Q4,
+// so the same defaults detect at about 3 times the noise and are close at about 6 times.
+static const struct detector_params default_params = {50, 50, 100, 100, 30, 128, 43, 20, 0, 0, 0, 8, 0};
+
+// converts a raw ADC register reading into mV
+uint16_t adc_to_mv(int raw)
+{
+    return ((raw >> 4) * 244) / 1000;
+}
+
+void read_adc_frame(struct adc_frame* p_frame)
+{
+	// the XADC sequencer converts the two channels one after the other on its own and each
+	// result register holds the latest conversion, reading one does not start a new one.
+	// the two readings are one sequencer step apart, a few uS, however the reads are timed,
+	// which is nothing next to a sweep. reading a register twice only returns the same
+	// conversion again, so each is read once.
+    p_frame->adc1 = adc_to_mv(ADC1);
+    p_frame->adc2 = adc_to_mv(ADC2);
+
+    return;
+} // end of read_adc_frame
+
+// last values written to the SSD and LEDs. writes that would not change anything are skipped,
+// and displays that have not changed for a while can be blanked to save power.
+struct display_cache
+{
+    _Bool valid;
+    _Bool is_hex;
+    uint32_t vector;
+    uint8_t dp_vector;
+    uint16_t led;
+    _Bool blanked;
+    uint16_t unchanged_cycles;
+};
+
+static struct display_cache display = {false, false, 0, 0, 0, false, 0};
+
+void write_SSD(_Bool is_hex, uint32_t whole_vector, uint8_t dp_vector)
 {
 	// checks whether the input data whole_vector is to be interpreted as hexadecimal data (4 bits per digit)
 	// or raw segment data (7 bits per digit)
@@ -87,24 +382,239 @@ void printSSD(_Bool is_hex, uint32_t whole_vector, uint8_t dp_vector)
         SSD_RAW_BOT = whole_vector & 0x3FFF;
     }
 
+    return;
+} // end of write_SSD
+
+void display_unblank(void)
+{
+	// puts the cached contents back on the SSD and LEDs after they were blanked
+    if (display.blanked)
+    {
+        display.blanked = false;
+        write_SSD(display.is_hex, display.vector, display.dp_vector);
+        LED = display.led;
+    }
+
+    return;
+} // end of display_unblank
+
+// readings of both coils at every excitation frequency. the coils are driven at one frequency
+// per main loop cycle, so each entry is refreshed every NUM_EXCITE_FREQS cycles and the latest
+// readings at different frequencies were taken with the coil in different places.
+struct excitation
+{
+    uint8_t slot;                           // frequency the coils are being driven at right now
+    uint16_t adc1[NUM_EXCITE_FREQS];        // latest reading in mV at each frequency
+    uint16_t adc2[NUM_EXCITE_FREQS];
+    uint16_t adc1_prev[NUM_EXCITE_FREQS];   // the reading before, NUM_EXCITE_FREQS cycles earlier
+    uint16_t adc2_prev[NUM_EXCITE_FREQS];
+    uint16_t adc1_cal[NUM_EXCITE_FREQS];    // calibrated reading in mV at each frequency
+    uint16_t adc2_cal[NUM_EXCITE_FREQS];
+    uint16_t adc1_own_cal[NUM_EXCITE_FREQS];    // what calibration() measured, adc1_cal is moved while a coil is replaced
+    uint16_t adc2_own_cal[NUM_EXCITE_FREQS];
+};
+
+void excite_select(uint8_t slot)
+{
+	// switches the coils over to excitation frequency slot
+#if NUM_EXCITE_FREQS > 1
+    EXCITE_SEL = slot;
+#else
+    (void)slot;
+#endif
+
+    return;
+} // end of excite_select
+
+void acquire_frame(struct excitation* p_exc, struct adc_frame* p_frame)
+{
+	// reads the coils at the frequency they are being driven at, then moves on to the next
+	// frequency so it has the rest of the main loop cycle to settle. the frame handed on to
+	// detection is the average over all frequencies, which lowers the noise without taking any
+	// more samples per cycle than a single frequency would.
+    struct adc_frame reading;
+    uint32_t sum_adc1 = 0;
+    uint32_t sum_adc2 = 0;
+
+    read_adc_frame(&reading);
+    p_exc->adc1_prev[p_exc->slot] = p_exc->adc1[p_exc->slot];
+    p_exc->adc2_prev[p_exc->slot] = p_exc->adc2[p_exc->slot];
+    p_exc->adc1[p_exc->slot] = reading.adc1;
+    p_exc->adc2[p_exc->slot] = reading.adc2;
+
+    p_exc->slot = (p_exc->slot + 1) % NUM_EXCITE_FREQS;
+    excite_select(p_exc->slot);
+
+    for (int i = 0; i < NUM_EXCITE_FREQS; i++)
+    {
+        sum_adc1 += p_exc->adc1[i];
+        sum_adc2 += p_exc->adc2[i];
+    }
+
+    p_frame->adc1 = sum_adc1 / NUM_EXCITE_FREQS;
+    p_frame->adc2 = sum_adc2 / NUM_EXCITE_FREQS;
+
+    return;
+} // end of acquire_frame
+
+uint16_t excite_aligned(const struct excitation* p_exc, const uint16_t* p_last, const uint16_t* p_prev, int freq)
+{
+	// the reading at freq as it would have been when the oldest of the latest readings was
+	// taken, NUM_EXCITE_FREQS - 1 cycles ago. each frequency has a reading at or after that
+	// instant and one before it, so it is interpolated between the two and never extrapolated.
+    // frequency just read, and how many cycles ago freq was read
+    int just_read = (p_exc->slot + NUM_EXCITE_FREQS - 1) % NUM_EXCITE_FREQS;
+    int age = (just_read - freq + NUM_EXCITE_FREQS) % NUM_EXCITE_FREQS;
+
+    return p_prev[freq] + ((p_last[freq] - p_prev[freq]) * (age + 1)) / NUM_EXCITE_FREQS;
+} // end of excite_aligned
+
+int32_t target_response_ratio(const struct excitation* p_exc)
+{
+	// ratio in Q8 of the drop seen at the highest excitation frequency to the drop at the lowest,
+	// over both coils. the eddy current response of a conductor rises with frequency, while the
+	// magnetic response of a ferrous target is strongest at low frequency, so the ratio tells
+	// them apart. the drops are aligned to one instant first, a sweep would otherwise compare
+	// frequencies read with the target in different places. 256 (a flat response) with a single
+	// frequency or nothing under the coils.
+    int32_t low = (p_exc->adc1_cal[0] - excite_aligned(p_exc, p_exc->adc1, p_exc->adc1_prev, 0))
+                  + (p_exc->adc2_cal[0] - excite_aligned(p_exc, p_exc->adc2, p_exc->adc2_prev, 0));
+    int32_t high = (p_exc->adc1_cal[NUM_EXCITE_FREQS - 1]
+                    - excite_aligned(p_exc, p_exc->adc1, p_exc->adc1_prev, NUM_EXCITE_FREQS - 1))
+                   + (p_exc->adc2_cal[NUM_EXCITE_FREQS - 1]
+                      - excite_aligned(p_exc, p_exc->adc2, p_exc->adc2_prev, NUM_EXCITE_FREQS - 1));
+
+    if (low <= 0 || high <= 0)
+    {
+        return 256;
+    }
+
+    return (high * 256) / low;
+} // end of target_response_ratio
+
+void printSSD(_Bool is_hex, uint32_t whole_vector, uint8_t dp_vector)
+{
+	// only writes the SSD when what is shown actually changes
+    if (display.valid && display.is_hex == is_hex && display.vector == whole_vector && display.dp_vector == dp_vector)
+    {
+        return;
+    }
+
+    display.valid = true;
+    display.is_hex = is_hex;
+    display.vector = whole_vector;
+    display.dp_vector = dp_vector;
+    display.unchanged_cycles = 0;
+
+    if (display.blanked)
+    {
+        display_unblank();
+    }
+    else
+    {
+        write_SSD(is_hex, whole_vector, dp_vector);
+    }
+
     return;
 } // end of printSSD
 
-void update_SSD_data(_Bool detected_left, _Bool detected_right, _Bool is_close)
+void set_LED(uint16_t led)
+{
+	// only writes the LEDs when the pattern actually changes
+    if (display.led == led)
+    {
+        return;
+    }
+
+    display.led = led;
+    display.unchanged_cycles = 0;
+
+    if (display.blanked)
+    {
+        display_unblank();
+    }
+    else
+    {
+        LED = led;
+    }
+
+    return;
+} // end of set_LED
+
+void display_tick(_Bool allow_blank, uint16_t blank_after_cycles)
+{
+	// called once per main loop cycle. blanks the SSD and LEDs once nothing on them has changed
+	// for blank_after_cycles, and brings them back when blanking is no longer allowed.
+    if (display.unchanged_cycles < UINT16_MAX)
+    {
+        display.unchanged_cycles++;
+    }
+
+    if (!allow_blank)
+    {
+        display_unblank();
+    }
+    else if (!display.blanked && display.unchanged_cycles >= blank_after_cycles)
+    {
+        // raw data with every segment bit high turns all segments off
+        display.blanked = true;
+        write_SSD(RAW_DATA, 0xFFFFFFF, 0b0000);
+        LED = 0x0000;
+    }
+
+    return;
+} // end of display_tick
+
+// contents of the SSD as raw segment data, so that views drawn in hex and as words can be
+// combined digit by digit
+struct ssd_image
+{
+    uint32_t vector;        // 7 bits per digit, leftmost digit in the top bits, as RAW_DATA
+    uint8_t dp_vector;
+};
+
+void set_image(struct ssd_image* p_img, uint32_t whole_vector, uint8_t dp_vector)
+{
+    p_img->vector = whole_vector;
+    p_img->dp_vector = dp_vector;
+
+    return;
+} // end of set_image
+
+void hex_image(struct ssd_image* p_img, uint16_t value, uint8_t dp_vector)
+{
+	// draws value as four hex digits, the same as the SSD does in HEX_DATA mode
+    static const uint8_t hex_segments[16] =
+    {
+        0b1000000, 0b1111001, 0b0100100, 0b0110000, 0b0011001, 0b0010010, 0b0000010, 0b1111000,
+        0b0000000, 0b0010000, 0b0001000, 0b0000011, 0b1000110, 0b0100001, 0b0000110, 0b0001110,
+    };
+
+    p_img->vector = 0;
+    for (int digit = 3; digit >= 0; digit--)
+    {
+        p_img->vector = (p_img->vector << 7) | hex_segments[(value >> (4 * digit)) & 0xF];
+    }
+    p_img->dp_vector = dp_vector;
+
+    return;
+} // end of hex_image
+
+void zone_image(_Bool detected_left, _Bool detected_right, _Bool is_close, struct ssd_image* p_img)
 {
 	// based on the boolean values of metal detection and whether or not it is close,
-	// print a different word to the seven segment display.
+	// a different word is drawn for the seven segment display.
     if (!detected_left && !detected_right)
     {	// no metal detected case
         // raw mode, vector says ndet, decimal point after n to imply two word output
-        printSSD(RAW_DATA, 0b0101011010000100001100000111, 0b1000);
+        set_image(p_img, 0b0101011010000100001100000111, 0b1000);
         return;
     }
 
     else if (detected_left && detected_right)
     {	// metal detected on both ADCs case
         // raw mode, vector says cntr, no decimal point.
-        printSSD(RAW_DATA, 0b1000110010101100001110101111, 0b0000);
+        set_image(p_img, 0b1000110010101100001110101111, 0b0000);
         return;
     }
 
@@ -115,13 +625,13 @@ void update_SSD_data(_Bool detected_left, _Bool detected_right, _Bool is_close)
 		if (detected_left && !detected_right)
 		{// far left case
 				// raw mode, vector says F.LFt
-				printSSD(RAW_DATA, 0b0001110100011100011100000111, 0b1000);
+				set_image(p_img, 0b0001110100011100011100000111, 0b1000);
 				return;
 		}
 
 		else if (!detected_left && detected_right)
 		{// far right case
-			  printSSD(RAW_DATA, 0b0001110010111100100000000111, 0b1000);
+			  set_image(p_img, 0b0001110010111100100000000111, 0b1000);
 			  return;
 		}
     }
@@ -132,67 +642,409 @@ void update_SSD_data(_Bool detected_left, _Bool detected_right, _Bool is_close)
         if (detected_left && !detected_right)
         {// far left case
                     // raw mode, vector says LEFt, no decimal point.
-            printSSD(RAW_DATA, 0b1000111000011000011100000111, 0b1000);
+            set_image(p_img, 0b1000111000011000011100000111, 0b1000);
             return;
         }
 
         else if (!detected_left && detected_right)
         {// far right case
             // raw mode, vector says rght, no decimal point.
-        	printSSD(RAW_DATA, 0b0101111001000000010010000111, 0b0000);
+        	set_image(p_img, 0b0101111001000000010010000111, 0b0000);
             return;
         }
     }
-} // end of update_SSD_data
+} // end of zone_image
+
+// self-test of the coils, ADCs and timer. it runs at boot while the title scrolls, and in the
+// background on quiet main loop cycles. faults are shown as Err codes on the SSD and sent as
+// $SLF telemetry, and a coil that fails is replaced by the other one until it passes again.
+
+// fault bits, the SSD shows Err and the number of the lowest one set, so Err1 for the first
+#define fault_adc1_range 0b000001   // ADC1 reads near 0 or full scale, coil open or shorted
+#define fault_adc2_range 0b000010
+#define fault_adc1_noise 0b000100   // ADC1 is much noisier than a healthy coil
+#define fault_adc2_noise 0b001000
+#define fault_balance 0b010000      // the two coils read too far apart to be the same design
+#define fault_timer 0b100000        // the timer does not scale with timer_dur
+
+#define fault_adc1 (fault_adc1_range | fault_adc1_noise)
+#define fault_adc2 (fault_adc2_range | fault_adc2_noise)
+
+// readings taken for each run of the ADC checks
+#define selftest_samples 256
+
+// a healthy coil reads between these, in mV. the XADC tops out at 999 mV.
+#define selftest_min_mv 50
+#define selftest_max_mv 975
+
+// largest noise variance in mV^2 of a healthy coil, 10 mV rms
+#define selftest_max_noise 100
+
+// timer check durations, a 2 mS timer has to take twice the polls of a 1 mS one to within 1/8
+#define selftest_timer_ms 1
+#define selftest_timer_timeout 0x1000000
+
+// in the field the longest wait for a tick in each run, over the polls the boot check says the
+// period should take, in Q8. the loop's own work keeps it a little under 256, a tick that
+// ran out early or late moves it outside these.
+#define selftest_wait_min 32
+#define selftest_wait_max (256 + 64)
+
+// how long a fault that appears in the field is shown on the SSD
+#define selftest_show_ms 2000
+
+// sums over the current run of one channel. the mean and the noise are both measured on quiet cycles,
+// the noise from the differences between consecutive readings, so a target swept past or held under
+// the coil during a background run does not count.
+struct selftest_channel
+{
+    uint32_t sum;           // readings on quiet cycles
+    uint32_t diff_sq_sum;
+    uint16_t last;
+    uint16_t mean;          // results of the last completed run
+    uint32_t noise;         // noise variance in mV^2
+};
+
+struct self_test
+{
+    struct selftest_channel adc1;
+    struct selftest_channel adc2;
+    uint16_t count;         // readings taken in the current run
+    uint16_t quiet;         // of which were differences taken with nothing under the coils
+    uint8_t faults;         // fault bits from the last completed checks
+    uint8_t degraded;       // fault_adc1 or fault_adc2 while a coil is failing, its readings are replaced
+    uint16_t timer_ratio;   // polls of the long timer over the short one in Q8, 512 when the timer is right
+    uint16_t show_cycles;   // main loop cycles left showing a new fault
+    uint32_t polls_per_ms;  // timer polls in a mS, from the boot check
+    uint16_t wait_ticks;    // ticks of the current run the longest wait was taken over
+    uint16_t wait_max;      // longest wait for a tick in the current run, over its period in Q8
+    uint16_t wait_ratio;    // wait_max of the last completed run
+};
+
+void selftest_sample(struct self_test* p_test, const struct adc_frame* p_frame, _Bool quiet)
+{
+	// adds one paired reading to the current run, quiet when nothing is being detected
+    int32_t diff1 = p_frame->adc1 - p_test->adc1.last;
+    int32_t diff2 = p_frame->adc2 - p_test->adc2.last;
+
+    if (p_test->count > 0 && quiet)
+    {
+        p_test->quiet++;
+        p_test->adc1.sum += p_frame->adc1;
+        p_test->adc2.sum += p_frame->adc2;
+        p_test->adc1.diff_sq_sum += diff1 * diff1;
+        p_test->adc2.diff_sq_sum += diff2 * diff2;
+    }
+
+    p_test->adc1.last = p_frame->adc1;
+    p_test->adc2.last = p_frame->adc2;
+    p_test->count++;
+
+    return;
+} // end of selftest_sample
+
+uint8_t selftest_channel_faults(struct selftest_channel* p_chan, uint16_t count, uint16_t quiet,
+                                uint8_t range_fault, uint8_t noise_fault)
+{
+	// finishes a run on one channel and starts the next
+    uint8_t faults = 0;
+
+    // the difference of two readings has twice the variance of the noise on each. a run that
+    // was mostly spent over a target keeps the last mean and noise figure, a strong target
+    // can pull a healthy coil's reading right down to 0.
+    if (quiet >= count / 4)
+    {
+        p_chan->mean = p_chan->sum / quiet;
+        p_chan->noise = p_chan->diff_sq_sum / (2 * quiet);
+    }
+
+    if (p_chan->mean < selftest_min_mv || p_chan->mean > selftest_max_mv)
+    {
+        faults |= range_fault;
+    }
+    if (p_chan->noise > selftest_max_noise)
+    {
+        faults |= noise_fault;
+    }
+
+    p_chan->sum = 0;
+    p_chan->diff_sq_sum = 0;
+
+    return faults;
+} // end of selftest_channel_faults
+
+void selftest_wait(struct self_test* p_test, const struct tick_state* p_tick)
+{
+	// adds the wait for the last tick to the current run. the period is known in timer cycles
+	// and the boot check knows the polls in a mS, so the wait can be compared with the period
+	// without borrowing the timer. a missed deadline counts as no wait at all.
+    uint32_t expected = p_test->polls_per_ms * (p_tick->last_period / (100 * 1000));
+    uint32_t ratio = p_tick->last_polls / ((expected >> 8) + 1);
+
+    ratio = (ratio > 0xFFFF) ? 0xFFFF : ratio;
+    p_test->wait_max = (ratio > p_test->wait_max) ? ratio : p_test->wait_max;
+    p_test->wait_ticks++;
+
+    return;
+} // end of selftest_wait
+
+uint8_t selftest_evaluate(struct self_test* p_test)
+{
+	// checks the completed run and returns the faults that were not there before.
+	// the timer fault from the boot check is kept until a run in the main loop has waited
+	// for ticks, which then checks the timer from the longest of those waits. while the
+	// MicroBlaze sleeps in tick_wait() the polls say nothing about time, so it is kept then too.
+    uint8_t faults = p_test->faults & fault_timer;
+    uint16_t high = 0;
+    uint16_t low = 0;
+    uint8_t new_faults = 0;
+
+#ifndef LOW_POWER_SLEEP
+    if (p_test->wait_ticks > 0 && p_test->polls_per_ms > 0)
+    {
+        p_test->wait_ratio = p_test->wait_max;
+        faults = (p_test->wait_max < selftest_wait_min || p_test->wait_max > selftest_wait_max) ? fault_timer : 0;
+    }
+#endif
+    p_test->wait_ticks = 0;
+    p_test->wait_max = 0;
+
+    faults |= selftest_channel_faults(&p_test->adc1, p_test->count, p_test->quiet, fault_adc1_range, fault_adc1_noise);
+    faults |= selftest_channel_faults(&p_test->adc2, p_test->count, p_test->quiet, fault_adc2_range, fault_adc2_noise);
+    p_test->count = 0;
+    p_test->quiet = 0;
+
+    // balance only means something when both coils work, more than 1/4 apart is a fault
+    high = (p_test->adc1.mean > p_test->adc2.mean) ? p_test->adc1.mean : p_test->adc2.mean;
+    low = (p_test->adc1.mean > p_test->adc2.mean) ? p_test->adc2.mean : p_test->adc1.mean;
+    if (!(faults & (fault_adc1 | fault_adc2)) && (high - low) * 4 > high)
+    {
+        faults |= fault_balance;
+    }
+
+    new_faults = faults & ~p_test->faults;
+
+    // a coil has to fail in two runs in a row to be replaced, a single burst of interference or
+    // a target does not take it out. it is back as soon as a run passes on it.
+    p_test->degraded |= faults & p_test->faults & (fault_adc1 | fault_adc2);
+    if (!(faults & fault_adc1))
+    {
+        p_test->degraded &= ~fault_adc1;
+    }
+    if (!(faults & fault_adc2))
+    {
+        p_test->degraded &= ~fault_adc2;
+    }
+    p_test->faults = faults;
+
+    return new_faults;
+} // end of selftest_evaluate
+
+uint32_t selftest_timer_polls(uint16_t millis)
+{
+	// polls it takes a timer of millis to run out, or selftest_timer_timeout if it never does
+    uint32_t polls = 0;
+
+    timer_dur = 100 * 1000 * millis;
+    while ((timer_state & 0b1) == 0 && polls < selftest_timer_timeout)
+    {
+        polls++;
+    }
+
+    return polls;
+} // end of selftest_timer_polls
+
+uint8_t selftest_timer(struct self_test* p_test)
+{
+	// there is no second clock to check the timer against, so it is checked against itself.
+	// a timer twice as long has to take twice as many polls, which catches a timer that
+	// ignores timer_dur, runs out straight away or never runs out. borrows the timer for
+	// 3 selftest_timer_ms, so it only runs at boot. returns fault_timer if the timer newly failed.
+    uint32_t short_polls = selftest_timer_polls(selftest_timer_ms);
+    uint32_t long_polls = selftest_timer_polls(2 * selftest_timer_ms);
+    uint8_t was_faulty = p_test->faults & fault_timer;
+
+    p_test->polls_per_ms = short_polls / selftest_timer_ms;
+
+    p_test->timer_ratio = (short_polls == 0) ? 0 : ((long_polls > 0xFFFF) ? 0xFFFF : (long_polls * 256) / short_polls);
+
+    if (short_polls == 0 || long_polls >= selftest_timer_timeout || p_test->timer_ratio < 512 - 64
+        || p_test->timer_ratio > 512 + 64)
+    {
+        p_test->faults |= fault_timer;
+    }
+    else
+    {
+        p_test->faults &= ~fault_timer;
+    }
+
+    return p_test->faults & fault_timer & ~was_faulty;
+} // end of selftest_timer
+
+void telemetry_selftest(const struct self_test* p_test)
+{
+	// $SLF,<fault bits>,<degraded bits>,<ADC1 mean mV>,<ADC2 mean mV>,<ADC1 noise mV^2>,<ADC2 noise mV^2>,
+	//      <boot timer ratio Q8>,<longest tick wait over the period Q8>
+    xil_printf("$SLF,%d,%d,%d,%d,%d,%d,%d,%d\r\n", (int)p_test->faults, (int)p_test->degraded, (int)p_test->adc1.mean,
+               (int)p_test->adc2.mean, (int)p_test->adc1.noise, (int)p_test->adc2.noise, (int)p_test->timer_ratio,
+               (int)p_test->wait_ratio);
+
+    return;
+} // end of telemetry_selftest
+
+void selftest_show(uint8_t faults)
+{
+	// Err followed by the number of the lowest fault bit set
+    struct ssd_image code;
+    uint8_t number = 1;
+
+    while (!(faults & 1) && number < 8)
+    {
+        faults >>= 1;
+        number++;
+    }
+
+    hex_image(&code, number, 0b0000);
+
+    // raw mode, vector says Err and the last digit is the fault number
+    printSSD(RAW_DATA, (0b000011001011110101111 << 7) | (code.vector & 0x7F), 0b0000);
+
+    return;
+} // end of selftest_show
+
+void selftest_degrade(const struct self_test* p_test, struct excitation* p_exc, struct adc_frame* p_frame,
+                      uint16_t* p_adc1_cal, uint16_t* p_adc2_cal)
+{
+	// single coil operation. a failed coil is given the reading and calibration of the working
+	// one, so detection and position carry on as if both coils sat over the same spot. left and
+	// right can no longer be told apart, a target is seen by both coils or neither.
+	// the readings at each frequency are left alone so the self-test keeps checking the failed
+	// coil. its calibration at each frequency is moved instead, so target ID sees the same aligned
+	// drop on it as on the working coil. a coil that passes again goes back to its own calibration.
+    int32_t cal = 0;
+    uint32_t adc1_sum = 0;
+    uint32_t adc2_sum = 0;
+
+    for (int i = 0; i < NUM_EXCITE_FREQS; i++)
+    {
+        if (!(p_test->degraded & fault_adc1))
+        {
+            p_exc->adc1_cal[i] = p_exc->adc1_own_cal[i];
+        }
+        if (!(p_test->degraded & fault_adc2))
+        {
+            p_exc->adc2_cal[i] = p_exc->adc2_own_cal[i];
+        }
+        adc1_sum += p_exc->adc1_own_cal[i];
+        adc2_sum += p_exc->adc2_own_cal[i];
+    }
+
+    // the overall calibrations are the averages calibration() worked out
+    if (!(p_test->degraded & fault_adc1))
+    {
+        *p_adc1_cal = adc1_sum / NUM_EXCITE_FREQS;
+    }
+    if (!(p_test->degraded & fault_adc2))
+    {
+        *p_adc2_cal = adc2_sum / NUM_EXCITE_FREQS;
+    }
+
+    if ((p_test->degraded & fault_adc1) && !(p_test->degraded & fault_adc2))
+    {
+        for (int i = 0; i < NUM_EXCITE_FREQS; i++)
+        {
+            cal = excite_aligned(p_exc, p_exc->adc1, p_exc->adc1_prev, i)
+                  + (p_exc->adc2_cal[i] - excite_aligned(p_exc, p_exc->adc2, p_exc->adc2_prev, i));
+            p_exc->adc1_cal[i] = (cal < 0) ? 0 : cal;
+        }
+        p_frame->adc1 = p_frame->adc2;
+        *p_adc1_cal = *p_adc2_cal;
+    }
+    else if ((p_test->degraded & fault_adc2) && !(p_test->degraded & fault_adc1))
+    {
+        for (int i = 0; i < NUM_EXCITE_FREQS; i++)
+        {
+            cal = excite_aligned(p_exc, p_exc->adc2, p_exc->adc2_prev, i)
+                  + (p_exc->adc1_cal[i] - excite_aligned(p_exc, p_exc->adc1, p_exc->adc1_prev, i));
+            p_exc->adc2_cal[i] = (cal < 0) ? 0 : cal;
+        }
+        p_frame->adc2 = p_frame->adc1;
+        *p_adc2_cal = *p_adc1_cal;
+    }
+
+    // with both coils failed there is nothing left to copy from
+    return;
+} // end of selftest_degrade
+
+void title_wait(uint16_t millis, struct self_test* p_test)
+{
+	// waits like delay_n_msecs while the self-test reads the coils once a mS
+    struct adc_frame frame;
+
+    for (uint16_t i = 0; i < millis; i++)
+    {
+        timer_dur = 100 * 1000;
+        read_adc_frame(&frame);
+        selftest_sample(p_test, &frame, true);
+        if (p_test->count == selftest_samples)
+        {
+            selftest_evaluate(p_test);
+        }
+        wait_for_tick();
+    }
+
+    return;
+} // end of title_wait
 
-void print_title()
+void print_title(struct self_test* p_test)
 {
 	// prints a title to the seven segment display on startup
-	// by shifting the appropriate characters in over time
+	// by shifting the appropriate characters in over time.
+	// the self-test checks the coils while it does.
 
 	// MET
     printSSD(RAW_DATA, 0b1001000111100000001100000111, 0b0000);
-    delay_n_msecs(500);
+    title_wait(500, p_test);
 
     // ETAL
     printSSD(RAW_DATA, 0b0000110000011100010001000111, 0b0000);
-    delay_n_msecs(250);
+    title_wait(250, p_test);
 
     // TAL_
     printSSD(RAW_DATA, 0b0000111000100010001111110111, 0b0000);
-    delay_n_msecs(250);
+    title_wait(250, p_test);
 
     // AL_D
     printSSD(RAW_DATA, 0b0001000100011111101110100001, 0b0000);
-    delay_n_msecs(250);
+    title_wait(250, p_test);
 
     // L_DE
     printSSD(RAW_DATA, 0b1000111111011101000010000110, 0b0000);
-    delay_n_msecs(250);
+    title_wait(250, p_test);
 
     // _DET
     printSSD(RAW_DATA, 0b1110111010000100001100000111, 0b0000);
-    delay_n_msecs(250);
+    title_wait(250, p_test);
 
     // DETE
     printSSD(RAW_DATA, 0b0100001000011000001110000110, 0b0000);
-    delay_n_msecs(250);
+    title_wait(250, p_test);
 
     // ETEC
     printSSD(RAW_DATA, 0b0000110000011100001101000110, 0b0000);
-    delay_n_msecs(250);
+    title_wait(250, p_test);
 
     // TECT
     printSSD(RAW_DATA, 0b0000111000011010001100000111, 0b0000);
-    delay_n_msecs(250);
+    title_wait(250, p_test);
 
     // ECTO
     printSSD(RAW_DATA, 0b0000110100011000001111000000, 0b0000);
-    delay_n_msecs(250);
+    title_wait(250, p_test);
 
     // CTOR
     printSSD(RAW_DATA, 0b1000110000011110000000101111, 0b0000);
-    delay_n_msecs(500);
+    title_wait(500, p_test);
     return;
 } // end of print_title
 
@@ -422,39 +1274,67 @@ _Bool btn_D_deb(void)
     return retval;
 }
 
-void calibration ( uint16_t* p_adc1_duration, uint16_t* p_adc2_duration)
+void calibration (struct excitation* p_exc, uint16_t* p_adc1_duration, uint16_t* p_adc2_duration)
 {
 
 	// set up the minimum observed adc value to be the highest the ints can store
     uint16_t adc1_min = UINT16_MAX;
     uint16_t adc2_min = UINT16_MAX;
 
-    // temp values to store
-    uint16_t adc1_temp = 0;
-    uint16_t adc2_temp = 0;
+    // paired reading of both channels taken at the same instant
+    struct adc_frame frame;
+
+    // sums of the per frequency calibrated values, averaged into the overall ones
+    uint32_t adc1_sum = 0;
+    uint32_t adc2_sum = 0;
 
     printSSD(0, 0b1000110000100010001110000011, 0b0001);
     delay_n_secs(1);
 
-    for (int i = 0; i < 1000; i++)
+    // every excitation frequency gets its own calibrated value
+    for (int slot = 0; slot < NUM_EXCITE_FREQS; slot++)
     {
-        timer_dur = 100;
-        adc1_temp = ( (ADC1 >> 4) * 244 / 1000);
-        if (adc1_min > adc1_temp)
-        {
-            adc1_min = adc1_temp;
-        }
-        while( (timer_state & 0b1) == 0){}
+        excite_select(slot);
+        delay_n_msecs(1);
 
-        timer_dur = 100;
-        adc2_temp = ( (ADC2 >> 4) * 244 / 1000);
-        if (adc2_min > adc2_temp)
+        adc1_min = UINT16_MAX;
+        adc2_min = UINT16_MAX;
+
+        for (int i = 0; i < 1000; i++)
         {
-            adc2_min = adc2_temp;
+            timer_dur = 100;
+            read_adc_frame(&frame);
+            if (adc1_min > frame.adc1)
+            {
+                adc1_min = frame.adc1;
+            }
+            if (adc2_min > frame.adc2)
+            {
+                adc2_min = frame.adc2;
+            }
+            wait_for_tick();
         }
-        while( (timer_state & 0b1) == 0){}
+
+        // the readings start out at the calibrated values, so nothing is seen until they are sampled
+        p_exc->adc1_cal[slot] = adc1_min;
+        p_exc->adc2_cal[slot] = adc2_min;
+        p_exc->adc1_own_cal[slot] = adc1_min;
+        p_exc->adc2_own_cal[slot] = adc2_min;
+        p_exc->adc1[slot] = adc1_min;
+        p_exc->adc2[slot] = adc2_min;
+        p_exc->adc1_prev[slot] = adc1_min;
+        p_exc->adc2_prev[slot] = adc2_min;
+        adc1_sum += adc1_min;
+        adc2_sum += adc2_min;
     }
 
+    // the main loop starts on the first frequency
+    p_exc->slot = 0;
+    excite_select(0);
+
+    adc1_min = adc1_sum / NUM_EXCITE_FREQS;
+    adc2_min = adc2_sum / NUM_EXCITE_FREQS;
+
     printSSD(RAW_DATA, 0b0001000010000110001101111001, 0b0000);
     delay_n_secs(1);
     printSSD(HEX_DATA, adc1_min, 0b0000);
@@ -472,367 +1352,1980 @@ void calibration ( uint16_t* p_adc1_duration, uint16_t* p_adc2_duration)
     return;
 }
 
-// bools needed to test if a newly seen object is detected, and whether that applies
-// to the close or far versions of non-centered positions
-void print_num_objects_SSD(_Bool adc1, _Bool adc2, _Bool is_close, uint8_t mode_input)
+// where under the coils metal is, zone_none when neither coil sees anything
+enum zone {zone_far_left, zone_left, zone_centre, zone_right, zone_far_right, zone_none};
+
+// number of objects seen in each zone. counting runs every main loop cycle whether or not the
+// counts are on the display, the counts view only reads them.
+struct zone_counter
+{
+    uint8_t counts[zone_none];
+    uint8_t previous;       // zone last counted, zone_none once the metal is lost
+    uint8_t same_count;     // cycles since the last count
+};
+
+uint8_t detection_zone(_Bool adc1, _Bool adc2, _Bool is_close)
+{
+	// zone the detection state of the two coils puts the metal in
+    if (adc1 && adc2)
+    {
+        return zone_centre;
+    }
+    else if (adc1)
+    {
+        return is_close ? zone_left : zone_far_left;
+    }
+    else if (adc2)
+    {
+        return is_close ? zone_right : zone_far_right;
+    }
+
+    return zone_none;
+} // end of detection_zone
+
+void zone_count_update(struct zone_counter* p_counter, _Bool adc1, _Bool adc2, _Bool is_close, uint16_t loop_ms)
+{
+	// an object is counted once metal has been seen in a zone other than the one last counted
+	// for 500 mS, so the same object is not counted twice as it passes under the coils.
+    uint8_t zone = detection_zone(adc1, adc2, is_close);
+
+    if (zone == zone_none)
+    {
+        p_counter->previous = zone_none;
+        p_counter->same_count = 0;
+    }
+    else if (p_counter->previous != zone && p_counter->same_count == 500 / loop_ms)
+    {
+        p_counter->counts[zone]++;
+        p_counter->previous = zone;
+        p_counter->same_count = 0;
+    }
+    else
+    {
+        p_counter->same_count++;
+    }
+
+    return;
+} // end of zone_count_update
+
+// debounced button presses seen during one main loop cycle
+struct button_events
+{
+    _Bool up;
+    _Bool down;
+    _Bool left;
+    _Bool right;
+};
+
+void read_buttons(struct button_events* p_btn)
+{
+	// every debounce state machine has to be stepped exactly once per main loop cycle,
+	// so all four are read here and the results are passed to whoever needs them.
+    p_btn->up = btn_U_deb();
+    p_btn->down = btn_D_deb();
+    p_btn->left = btn_L_deb();
+    p_btn->right = btn_R_deb();
+
+    return;
+} // end of read_buttons
+
+// the detection log lives in RAM, so it is lost on reset like everything else. it holds the
+// last log_max_records detections, older ones are overwritten.
+#define log_max_records 256
+
+// distinct parameter sets the log remembers, records point at the one in use when they were made.
+// sets are numbered in the order they were stored and set n is kept at n % log_max_param_sets,
+// so only the last log_max_param_sets of them are still held.
+#define log_max_param_sets 8
+
+// record flags
+#define log_flag_close 0b001    // close at the peak
+#define log_flag_left 0b010     // seen on the left coil (ADC1) at some point
+#define log_flag_right 0b100    // seen on the right coil (ADC2) at some point
+
+// one detection, 12 bytes
+struct log_record
+{
+    uint32_t time_ms;       // start of the detection, mS since the main loop started
+    uint16_t peak;          // peak strength, total drop of both coils in mV
+    uint16_t duration_ms;   // how long the detection lasted, saturates at 65535
+    uint8_t zone;           // enum zone at the peak
+    uint8_t flags;
+    uint16_t param_set;     // number of the parameter set in use, see log_max_param_sets
+};
+
+// append-only detection log. records are stored in order in a ring, so record n of the log is
+// at index n % log_max_records and any page can be found without searching.
+struct detection_log
+{
+    struct log_record records[log_max_records];
+    uint32_t count;                 // records ever appended since the last clear
+    struct detector_params param_sets[log_max_param_sets];
+    uint16_t num_param_sets;        // param sets ever stored, the next one stored gets this number
+    _Bool active;                   // a detection is in progress
+    struct log_record current;      // the detection in progress
+    uint16_t export_line;           // next line of a running export, 0 when not exporting
+    uint32_t export_count;          // count when the running export started, later records are left out
+    uint16_t export_sets;           // num_param_sets when the running export started
+};
+
+static struct detection_log hit_log;
+
+uint16_t log_param_set(struct detection_log* p_log, const struct detector_params* p_params)
+{
+	// number of the stored copy of the current parameters, storing a new one if they changed
+	// since the last record. the number keeps counting up as the table wraps around, so a
+	// record can always tell whether its set is still held.
+    uint16_t latest = p_log->num_param_sets - 1;
+    const uint16_t* p_new = (const uint16_t*)p_params;
+    const uint16_t* p_old = (const uint16_t*)&p_log->param_sets[latest % log_max_param_sets];
+    _Bool changed = (p_log->num_param_sets == 0);
+
+    for (size_t i = 0; i < sizeof(struct detector_params) / sizeof(uint16_t); i++)
+    {
+        changed |= (p_new[i] != p_old[i]);
+    }
+
+    if (changed)
+    {
+        latest = p_log->num_param_sets;
+        p_log->param_sets[latest % log_max_param_sets] = *p_params;
+        p_log->num_param_sets++;
+    }
+
+    return latest;
+} // end of log_param_set
+
+void log_update(struct detection_log* p_log, _Bool left, _Bool right, _Bool is_close, uint16_t strength,
+                const struct detector_params* p_params, uint32_t now_ms)
+{
+	// follows a detection from when either coil first sees metal until both have lost it,
+	// keeping the zone at the strongest point, then appends it to the log
+    struct log_record* p_rec = &p_log->current;
+    uint32_t duration = 0;
+
+    if (!left && !right)
+    {
+        if (p_log->active)
+        {
+            p_log->active = false;
+            duration = now_ms - p_rec->time_ms;
+            p_rec->duration_ms = (duration > UINT16_MAX) ? UINT16_MAX : duration;
+            p_rec->param_set = log_param_set(p_log, p_params);
+            p_log->records[p_log->count % log_max_records] = *p_rec;
+            p_log->count++;
+        }
+        return;
+    }
+
+    if (!p_log->active)
+    {
+        p_log->active = true;
+        p_rec->time_ms = now_ms;
+        p_rec->peak = 0;
+        p_rec->flags = 0;
+    }
+
+    p_rec->flags |= (left ? log_flag_left : 0) | (right ? log_flag_right : 0);
+
+    if (strength >= p_rec->peak)
+    {
+        p_rec->peak = strength;
+        p_rec->zone = detection_zone(left, right, is_close);
+        p_rec->flags = (p_rec->flags & ~log_flag_close) | (is_close ? log_flag_close : 0);
+    }
+
+    return;
+} // end of log_update
+
+uint16_t log_size(const struct detection_log* p_log)
+{
+	// number of records held, at most log_max_records
+    return (p_log->count > log_max_records) ? log_max_records : p_log->count;
+} // end of log_size
+
+uint32_t log_oldest(const struct detection_log* p_log)
+{
+	// number of the oldest record still held
+    return p_log->count - log_size(p_log);
+} // end of log_oldest
+
+const struct log_record* log_record_at(const struct detection_log* p_log, uint32_t number)
+{
+	// record number of the log, which has to be between log_oldest() and count - 1
+    return &p_log->records[number % log_max_records];
+} // end of log_record_at
+
+void log_clear(struct detection_log* p_log)
+{
+	// empties the log and forgets the stored parameter sets
+    p_log->count = 0;
+    p_log->num_param_sets = 0;
+    p_log->active = false;
+    p_log->export_line = 0;
+
+    return;
+} // end of log_clear
+
+void log_export_start(struct detection_log* p_log)
+{
+	// starts sending the log as it is now, log_export_tick() then sends it a line at a time
+    p_log->export_line = 1;
+    p_log->export_count = p_log->count;
+    p_log->export_sets = p_log->num_param_sets;
+
+    return;
+} // end of log_export_start
+
+void log_export_tick(struct detection_log* p_log)
+{
+	// an export sends one line per main loop cycle, so the UART never holds up the main loop.
+	// the lines are, in order:
+	//   $LGH,<records ever appended>,<records held>
+	//   $LGP,<set number>,<every detector_params field in order>, for each parameter set still held
+	//   $LOG,<record number>,<time mS>,<zone>,<peak mV>,<duration mS>,<set number>,<flags>, oldest first
+	//   $LGE
+	// a record whose set number has no $LGP line was made with a set that has since been
+	// overwritten. host/log2csv turns them into a CSV file.
+    uint16_t line = p_log->export_line;
+    uint16_t sets = (p_log->export_sets > log_max_param_sets) ? log_max_param_sets : p_log->export_sets;
+    uint16_t first_set = p_log->export_sets - sets;
+    uint16_t set = 0;
+    uint32_t first = log_oldest(p_log);
+    uint32_t held = p_log->export_count - first;
+    const uint16_t* p_values = NULL;
+    const struct log_record* p_rec = NULL;
+
+    if (line == 0)
+    {
+        return;
+    }
+    p_log->export_line++;
+
+    // line 1 is the header, the parameter sets and records follow
+    line--;
+    if (line == 0)
+    {
+        xil_printf("$LGH,%d,%d\r\n", (int)p_log->export_count, (int)held);
+        return;
+    }
+
+    line--;
+    if (line < sets)
+    {
+        // a set overwritten since the export started is left out, its records show as overwritten
+        set = first_set + line;
+        if ((uint16_t)(p_log->num_param_sets - set) > log_max_param_sets)
+        {
+            return;
+        }
+
+        p_values = (const uint16_t*)&p_log->param_sets[set % log_max_param_sets];
+        xil_printf("$LGP,%d", (int)set);
+        for (size_t i = 0; i < sizeof(struct detector_params) / sizeof(uint16_t); i++)
+        {
+            xil_printf(",%d", (int)p_values[i]);
+        }
+        xil_printf("\r\n");
+        return;
+    }
+
+    line -= sets;
+    if (line < held)
+    {
+        p_rec = log_record_at(p_log, first + line);
+        xil_printf("$LOG,%d,%d,%d,%d,%d,%d,%d\r\n", (int)(first + line), (int)p_rec->time_ms,
+                   (int)p_rec->zone, (int)p_rec->peak, (int)p_rec->duration_ms, (int)p_rec->param_set,
+                   (int)p_rec->flags);
+        return;
+    }
+
+    xil_printf("$LGE\r\n");
+    p_log->export_line = 0;
+
+    return;
+} // end of log_export_tick
+
+// menu_item.parent of the items on the top level of the menu
+#define menu_top 0xFF
+
+// menu_item.param of items that open a sub menu instead of editing a value
+#define menu_no_param 0xFF
+
+// menu_item.param of items that start an action instead of editing a value. actions are
+// numbered down from menu_action_pump, all but the log viewer are handed to the main loop
+// through menu_state.action.
+#define menu_action_pump 0xFE
+#define menu_action_log_send 0xFD
+#define menu_action_log_clear 0xFC
+#define menu_action_log_view 0xFB
+
+// one entry of the runtime menu. items that share a parent are cycled with the left and right
+// buttons, down opens the sub menu or starts editing, up goes back one level.
+struct menu_item
+{
+    uint32_t label;     // raw SSD vector shown while the item is selected
+    uint8_t parent;     // index of the parent item, or menu_top
+    uint8_t param;      // offset of the edited value in struct detector_params, menu_no_param or an action
+    uint8_t digit;      // hex digit shown in front of the value while editing
+    uint8_t is_close;   // previews the close margin instead of the detection margin while editing
+    uint16_t min;       // range the value from pmod_counter is clamped to
+    uint16_t max;
+};
+
+static const struct menu_item menu_items[] =
+{
+    // trsh (threshold)
+    {0b0000111010111100100100001011, menu_top, menu_no_param, 0x0, 0, 0, 0},
+    // adc1
+    {0b0001000010000110001101001111, 0, offsetof(struct detector_params, threshold_adc1), 0x1, 0, 1, 0xFFF},
+    // adc2
+    {0b0001000010000110001100100100, 0, offsetof(struct detector_params, threshold_adc2), 0x2, 0, 1, 0xFFF},
+    // clse (close value)
+    {0b1000110100011100100100000110, menu_top, menu_no_param, 0x0, 1, 0, 0},
+    // adc1
+    {0b0001000010000110001101001111, 3, offsetof(struct detector_params, close_adc1), 0x1, 1, 1, 0xFFF},
+    // adc2
+    {0b0001000010000110001100100100, 3, offsetof(struct detector_params, close_adc2), 0x2, 1, 1, 0xFFF},
+    // dEAd (deadzone)
+    {0b0100001000011000010000100001, menu_top, offsetof(struct detector_params, deadzone), 0xD, 0, 0, 0x1FF},
+    // FiLt (position filter)
+    {0b0001110110111110001110000111, menu_top, menu_no_param, 0x0, 0, 0, 0},
+    // ALPh
+    {0b0001000100011100011000001011, 7, offsetof(struct detector_params, pos_alpha), 0xA, 0, 1, 256},
+    // bEtA
+    {0b0000011000011000001110001000, 7, offsetof(struct detector_params, pos_beta), 0xB, 0, 0, 256},
+    // rAtE (main loop period in mS)
+    {0b0101111000100000001110000110, menu_top, offsetof(struct detector_params, loop_ms), 0xF, 0, 5, 100},
+    // Gnd (ground balance)
+    {0b1000010010101101000011111111, menu_top, menu_no_param, 0x0, 0, 0, 0},
+    // nodE (off, manual, auto)
+    {0b0101011010001101000010000110, 11, offsetof(struct detector_params, gnd_mode), 0x0, 0, 0, 2},
+    // PunP (learn the ground offsets)
+    {0b0001100110001101010110001100, 11, menu_action_pump, 0x0, 0, 0, 0},
+    // Gnd1
+    {0b1000010010101101000011111001, 11, offsetof(struct detector_params, gnd_offset_adc1), 0x1, 0, 0, 0xFFF},
+    // Gnd2
+    {0b1000010010101101000010100100, 11, offsetof(struct detector_params, gnd_offset_adc2), 0x2, 0, 0, 0xFFF},
+    // trAC (automatic tracking time constant)
+    {0b0000111010111100010001000110, 11, offsetof(struct detector_params, gnd_track), 0x7, 0, 1, 12},
+    // CFAr (noise following thresholds, off or on)
+    {0b1000110000111000010000101111, menu_top, offsetof(struct detector_params, cfar), 0xC, 0, 0, 1},
+    // LOG (detection log)
+    {0b1000111100000010000101111111, menu_top, menu_no_param, 0x0, 0, 0, 0},
+    // LiSt (page through the log)
+    {0b1000111110111100100100000111, 18, menu_action_log_view, 0x0, 0, 0, 0},
+    // SEnd (export the log over the UART)
+    {0b0010010000011001010110100001, 18, menu_action_log_send, 0x0, 0, 0, 0},
+    // CLr (clear the log)
+    {0b1000110100011101011111111111, 18, menu_action_log_clear, 0x0, 0, 0, 0},
+};
+
+#define num_menu_items (sizeof(menu_items) / sizeof(menu_items[0]))
+
+struct menu_state
+{
+    _Bool open;
+    _Bool editing;
+    uint8_t item;       // index into menu_items of the selected item
+    uint8_t flash;      // main loop cycles left showing SEt after a value was stored
+    uint8_t action;     // action picked from the menu for the main loop to start, 0 when none
+    _Bool viewing;      // paging through the detection log
+    uint32_t page;      // number of the log record shown while viewing
+    uint16_t candidate; // value the knob would store, clamped to the item being edited
+};
+
+uint16_t* menu_value(struct detector_params* p_params, uint8_t param)
+{
+	// the value an item edits, found from its offset into the parameter struct
+    return (uint16_t*)((uint8_t*)p_params + param);
+} // end of menu_value
+
+uint8_t menu_sibling(uint8_t item, _Bool forward)
+{
+	// steps to the next or previous item with the same parent, wrapping around
+    uint8_t next = item;
+
+    do
+    {
+        next = forward ? (next + 1) % num_menu_items : (next + num_menu_items - 1) % num_menu_items;
+    }
+    while (menu_items[next].parent != menu_items[item].parent);
+
+    return next;
+} // end of menu_sibling
+
+uint16_t margin_bar(q8_t signal, q8_t level)
+{
+	// number of LEDs (0 to 8) showing how far a channel is from tripping a level, both in Q8 mV.
+	// 8 LEDs when nothing is seen and none once the signal reaches the level.
+    signal = q8_max0(signal);
+
+    if (level <= 0 || signal >= level)
+    {
+        return 0;
+    }
+
+    return (((int64_t)level - signal) * 8 + level - 1) / level;
+} // end of margin_bar
+
+_Bool menu_update(struct menu_state* p_menu, struct detector_params* p_params, const struct button_events* p_btn)
+{
+	// runs one main loop cycle of the menu. nothing in here waits, so detection keeps running
+	// while values are being changed. returns true while the menu is using the SSD and LEDs.
+	// the LEDs are left to menu_preview() except while the log is being viewed.
+
+    const struct menu_item* p_item = &menu_items[p_menu->item];
+    uint16_t candidate = pmod_counter;
+
+    // the value knob is clamped to the range of the item being edited
+    if (candidate < p_item->min)
+    {
+        candidate = p_item->min;
+    }
+    else if (candidate > p_item->max)
+    {
+        candidate = p_item->max;
+    }
+
+    if (!p_menu->open)
+    {
+        // up opens the menu on the thresholds, down on the close values, as the old setup screens did
+        if (!p_btn->up && !p_btn->down)
+        {
+            return false;
+        }
+        p_menu->open = true;
+        p_menu->editing = false;
+        p_menu->item = p_btn->up ? 0 : 3;
+        p_menu->flash = 0;
+    }
+    else if (p_menu->editing)
+    {
+        if (p_btn->down)
+        {
+            // store the value, the rest of the firmware picks it up next main loop cycle
+            *menu_value(p_params, p_item->param) = candidate;
+            p_menu->editing = false;
+            p_menu->flash = 1000 / p_params->loop_ms;
+        }
+        else if (p_btn->up)
+        {
+            // leave without changing the value
+            p_menu->editing = false;
+        }
+    }
+    else if (p_menu->viewing)
+    {
+        // left goes back to older records, right forward to newer ones, up leaves the log.
+        // a record overwritten while it was shown moves the page on to the oldest one left.
+        if (p_menu->page < log_oldest(&hit_log))
+        {
+            p_menu->page = log_oldest(&hit_log);
+        }
+
+        if (p_btn->left && p_menu->page > log_oldest(&hit_log))
+        {
+            p_menu->page--;
+        }
+        else if (p_btn->right && p_menu->page + 1 < hit_log.count)
+        {
+            p_menu->page++;
+        }
+        else if (p_btn->up)
+        {
+            p_menu->viewing = false;
+        }
+    }
+    else if (p_btn->left || p_btn->right)
+    {
+        p_menu->item = menu_sibling(p_menu->item, p_btn->right);
+        p_menu->flash = 0;
+    }
+    else if (p_btn->down)
+    {
+        if (p_item->param == menu_no_param)
+        {
+            // first item of the sub menu, sub menu items are listed right after their parent
+            p_menu->item = p_menu->item + 1;
+        }
+        else if (p_item->param == menu_action_log_view)
+        {
+            // starts on the newest record
+            p_menu->viewing = true;
+            p_menu->page = hit_log.count ? hit_log.count - 1 : 0;
+        }
+        else if (p_item->param >= menu_action_log_clear)
+        {
+            // the other actions are started by the main loop
+            p_menu->action = p_item->param;
+        }
+        else
+        {
+            p_menu->editing = true;
+        }
+        p_menu->flash = 0;
+    }
+    else if (p_btn->up)
+    {
+        if (p_item->parent == menu_top)
+        {
+            p_menu->open = false;
+            return false;
+        }
+        p_menu->item = p_item->parent;
+        p_menu->flash = 0;
+    }
+
+    p_item = &menu_items[p_menu->item];
+    p_menu->candidate = candidate;
+
+    if (p_menu->flash)
+    {
+        // SEt, shown for a second after a value was stored
+        p_menu->flash--;
+        printSSD(RAW_DATA, 0b0010010000011000001111111111, 0b0000);
+    }
+    else if (p_menu->editing)
+    {
+        // first segment indicates the value being edited, last three the value itself
+        printSSD(HEX_DATA, (p_item->digit << 12) | (candidate & 0xFFF), 0b1000);
+    }
+    else if (p_menu->viewing && log_size(&hit_log) == 0)
+    {
+        // nonE, nothing has been logged
+        printSSD(RAW_DATA, 0b0101011010001101010110000110, 0b0000);
+    }
+    else if (p_menu->viewing)
+    {
+        // first segment is the zone of the record, last three its peak strength in mV
+        const struct log_record* p_rec = log_record_at(&hit_log, p_menu->page);
+        printSSD(HEX_DATA, (p_rec->zone << 12) | ((p_rec->peak > 0xFFF) ? 0xFFF : p_rec->peak), 0b1000);
+    }
+    else
+    {
+        printSSD(RAW_DATA, p_item->label, 0b0000);
+    }
+
+    // the LEDs show the number of the record in binary, counting from 1
+    if (p_menu->viewing)
+    {
+        set_LED(p_menu->page + 1);
+    }
+
+    return true;
+} // end of menu_update
+
+// detection state of one coil
+struct detect_channel
+{
+    _Bool detected;     // metal seen, far unless close is also set
+    _Bool close;        // metal seen and close
+};
+
+// thresholds a coil is compared against this cycle, in Q8 mV or CFAR excess
+struct channel_levels
+{
+    q8_t detect;
+    q8_t close;
+    q8_t half_deadzone;
+};
+
+void update_channel(struct detect_channel* p_chan, q8_t drop, q8_t detect_level, q8_t close_level, q8_t half_deadzone)
+{
+	// steps a coil between ndet, far and close. drop is how far the reading is below calibration,
+	// and every step needs the drop to clear its threshold by half the deadzone:
+	//   ndet  -> far   when drop > detect + deadzone / 2
+	//   far   -> ndet  when drop < detect - deadzone / 2
+	//   far   -> close when drop > close + deadzone / 2
+	//   close -> far   when drop < close - deadzone / 2
+	// the compares are branch free, so the time taken does not depend on the signal.
+    int32_t detected = p_chan->detected;
+    int32_t close = p_chan->close;
+    int32_t enter_detect = q8_gt(drop, q8_add(detect_level, half_deadzone));
+    int32_t leave_detect = q8_gt(q8_sub(detect_level, half_deadzone), drop);
+    int32_t enter_close = q8_gt(drop, q8_add(close_level, half_deadzone));
+    int32_t leave_close = q8_gt(q8_sub(close_level, half_deadzone), drop);
+
+    p_chan->detected = ((detected ^ 1) & enter_detect) | (detected & (close | (leave_detect ^ 1)));
+    p_chan->close = detected & ((close & (leave_close ^ 1)) | ((close ^ 1) & (leave_detect ^ 1) & enter_close));
+
+    return;
+} // end of update_channel
+
+// CFAR (constant false alarm rate) detection. instead of fixed thresholds in mV, each channel
+// keeps a running estimate of its background level and noise from reference cells either side
+// of a cell under test, and the thresholds become multiples of the noise. the cell under test is
+// cfar_ref_cells + cfar_guard_cells main loop cycles old, so detection runs that much behind.
+#define cfar_ref_cells 8
+
+// cells between the cell under test and each reference window, so the edges of a target
+// passing under the coil do not count as noise
+#define cfar_guard_cells 2
+
+#define cfar_cells (2 * (cfar_ref_cells + cfar_guard_cells) + 1)
+
+// the noise estimate never goes below half a mV (Q8), readings are whole mV so a quiet
+// channel could otherwise estimate no noise at all and trip on a single LSB
+#define cfar_min_noise 128
+
+// running CFAR state of one channel. cells are stored newest first from head, at ages 0 to
+// cfar_cells - 1. ages below cfar_ref_cells are the leading window, the cell under test sits in
+// the middle, and the last cfar_ref_cells ages are the lagging window.
+struct cfar_channel
+{
+    q8_t drop[cfar_cells];      // drop below calibration of each cell
+    q8_t change[cfar_cells];    // size of the change in drop from the cell before
+    uint8_t head;               // index of the newest cell
+    q8_t last_drop;
+    q8_t lead_sum;              // drops summed over the leading window
+    q8_t lag_sum;               // drops summed over the lagging window
+    q8_t change_sum;            // changes summed over both windows
+    q8_t excess;                // drop of the cell under test above the background level
+    q8_t noise;                 // mean change over both windows
+};
+
+uint8_t cfar_cell(const struct cfar_channel* p_cfar, uint8_t age)
+{
+	// index of the cell age main loop cycles old
+    return (p_cfar->head + cfar_cells - age) % cfar_cells;
+} // end of cfar_cell
+
+void cfar_update(struct cfar_channel* p_cfar, q8_t drop)
+{
+	// adds a new drop and slides both reference windows on by one cell. the running sums are
+	// only adjusted for the cells that enter and leave each window, so this takes the same time
+	// whatever the window sizes.
+    q8_t change = (drop > p_cfar->last_drop) ? drop - p_cfar->last_drop : p_cfar->last_drop - drop;
+    uint8_t cell = 0;
+    q8_t background = 0;
+
+    p_cfar->last_drop = drop;
+
+    // the oldest cell leaves the lagging window and is overwritten by the new one
+    p_cfar->head = cfar_cell(p_cfar, cfar_cells - 1);
+    p_cfar->lag_sum -= p_cfar->drop[p_cfar->head];
+    p_cfar->change_sum -= p_cfar->change[p_cfar->head];
+
+    p_cfar->drop[p_cfar->head] = drop;
+    p_cfar->change[p_cfar->head] = change;
+    p_cfar->lead_sum += drop;
+    p_cfar->change_sum += change;
+
+    // one cell moves out of the leading window into the guard cells
+    cell = cfar_cell(p_cfar, cfar_ref_cells);
+    p_cfar->lead_sum -= p_cfar->drop[cell];
+    p_cfar->change_sum -= p_cfar->change[cell];
+
+    // and one moves out of the guard cells into the lagging window
+    cell = cfar_cell(p_cfar, cfar_ref_cells + 2 * cfar_guard_cells + 1);
+    p_cfar->lag_sum += p_cfar->drop[cell];
+    p_cfar->change_sum += p_cfar->change[cell];
+
+    // the background is the quieter of the two windows, so a target already in one of them
+    // does not raise the level the cell under test is compared against
+    background = ((p_cfar->lead_sum < p_cfar->lag_sum) ? p_cfar->lead_sum : p_cfar->lag_sum) / cfar_ref_cells;
+    p_cfar->excess = q8_sub(p_cfar->drop[cfar_cell(p_cfar, cfar_ref_cells + cfar_guard_cells)], background);
+
+    p_cfar->noise = p_cfar->change_sum / (2 * cfar_ref_cells);
+    if (p_cfar->noise < cfar_min_noise)
+    {
+        p_cfar->noise = cfar_min_noise;
+    }
+
+    return;
+} // end of cfar_update
+
+q8_t cfar_level(const struct cfar_channel* p_cfar, uint16_t factor)
+{
+	// a threshold factor times the noise estimate. with CFAR on, the thresholds and deadzone in
+	// detector_params are these factors in Q4, so 16 is once the noise.
+    return (p_cfar->noise / 16) * factor;
+} // end of cfar_level
+
+q8_t param_level(const struct detector_params* p_params, const struct cfar_channel* p_cfar, uint16_t value)
+{
+	// the level in Q8 mV a threshold or deadzone in detector_params stands for on one channel,
+	// mV with CFAR off and a noise multiple with it on. anything that compares a signal with
+	// the thresholds goes through here or the levels detection worked out from it.
+    return p_params->cfar ? cfar_level(p_cfar, value) : q8_from_mv(value);
+} // end of param_level
+
+q8_t activity_level(const struct detector_params* p_params, const struct channel_levels* p_levels)
+{
+	// the signal above which a coil could be starting to see metal, half the detect level with
+	// fixed thresholds. CFAR levels are set from the noise, so anything short of the level a
+	// detection starts at is noise there.
+    return p_params->cfar ? q8_add(p_levels->detect, p_levels->half_deadzone) : p_levels->detect / 2;
+} // end of activity_level
+
+// the detection core, everything from a frame to the detection state of both coils. the host
+// batch tool runs this same code over recorded traces, so anything that changes what is
+// detected belongs in here rather than in main().
+struct detector
+{
+    struct cfar_channel cfar_adc1;      // background and noise of each coil, kept up to date even while CFAR is off
+    struct cfar_channel cfar_adc2;
+    struct detect_channel left;         // ndet / far / close state of the left (ADC1) and right (ADC2) coils
+    struct detect_channel right;
+    _Bool is_close;
+    q8_t ground_adc1;                   // ground drop taken off each channel, set by ground_balance_apply()
+    q8_t ground_adc2;
+    q8_t drop_adc1;                     // drop of each channel below its calibrated value less the ground, and of both together
+    q8_t drop_adc2;
+    q8_t strength_total;
+    q8_t signal_adc1;                   // what each coil is detected on, the drop with CFAR off or the CFAR excess with it on
+    q8_t signal_adc2;
+    struct channel_levels levels_adc1;  // thresholds each coil is compared against this cycle
+    struct channel_levels levels_adc2;
+};
+
+void detector_update(struct detector* p_det, const struct detector_params* p_params, const struct adc_frame* p_frame,
+                     uint16_t adc1_cal, uint16_t adc2_cal)
+{
+	// one main loop cycle of detection on a frame
+    // drops are signed, so a reading above calibration or a threshold above the baseline
+    // can no longer wrap around and look like a huge drop. the ground comes off in Q8.
+    p_det->drop_adc1 = q8_sub(q8_sub(q8_from_mv(adc1_cal), q8_from_mv(p_frame->adc1)), p_det->ground_adc1);
+    p_det->drop_adc2 = q8_sub(q8_sub(q8_from_mv(adc2_cal), q8_from_mv(p_frame->adc2)), p_det->ground_adc2);
+
+    // the total drop clipped to 0, readings above calibration are only noise
+    p_det->strength_total = q8_max0(q8_add(p_det->drop_adc1, p_det->drop_adc2));
+
+    cfar_update(&p_det->cfar_adc1, p_det->drop_adc1);
+    cfar_update(&p_det->cfar_adc2, p_det->drop_adc2);
+
+    // updating the ndet / far / close state of both coils, against thresholds that follow
+    // the noise with CFAR on or the fixed thresholds in mV with it off
+    p_det->signal_adc1 = p_params->cfar ? p_det->cfar_adc1.excess : p_det->drop_adc1;
+    p_det->signal_adc2 = p_params->cfar ? p_det->cfar_adc2.excess : p_det->drop_adc2;
+    p_det->levels_adc1.detect = param_level(p_params, &p_det->cfar_adc1, p_params->threshold_adc1);
+    p_det->levels_adc1.close = param_level(p_params, &p_det->cfar_adc1, p_params->close_adc1);
+    p_det->levels_adc1.half_deadzone = param_level(p_params, &p_det->cfar_adc1, p_params->deadzone) / 2;
+    p_det->levels_adc2.detect = param_level(p_params, &p_det->cfar_adc2, p_params->threshold_adc2);
+    p_det->levels_adc2.close = param_level(p_params, &p_det->cfar_adc2, p_params->close_adc2);
+    p_det->levels_adc2.half_deadzone = param_level(p_params, &p_det->cfar_adc2, p_params->deadzone) / 2;
+    update_channel(&p_det->left, p_det->signal_adc1, p_det->levels_adc1.detect, p_det->levels_adc1.close,
+                   p_det->levels_adc1.half_deadzone);
+    update_channel(&p_det->right, p_det->signal_adc2, p_det->levels_adc2.detect, p_det->levels_adc2.close,
+                   p_det->levels_adc2.half_deadzone);
+
+    p_det->is_close = p_det->left.close || p_det->right.close;
+
+    return;
+} // end of detector_update
+
+void menu_preview(const struct menu_state* p_menu, const struct detector_params* p_params, const struct detector* p_det)
 {
-    static uint8_t one_second_cntr = 0;
+	// live preview of how far each channel is from tripping, while the menu is open and not on
+	// the log. left 8 LEDs are ADC1 and right 8 LEDs are ADC2. the value being edited is
+	// previewed before it is stored, in the units the thresholds are in.
+    const struct menu_item* p_item = &menu_items[p_menu->item];
+    q8_t level_adc1 = p_item->is_close ? p_det->levels_adc1.close : p_det->levels_adc1.detect;
+    q8_t level_adc2 = p_item->is_close ? p_det->levels_adc2.close : p_det->levels_adc2.detect;
+    uint16_t bar_adc1 = 0;
+    uint16_t bar_adc2 = 0;
+
+    if (!p_menu->open || p_menu->viewing)
+    {
+        return;
+    }
+
+    if (p_menu->editing && (p_item->param == offsetof(struct detector_params, threshold_adc1)
+                            || p_item->param == offsetof(struct detector_params, close_adc1)))
+    {
+        level_adc1 = param_level(p_params, &p_det->cfar_adc1, p_menu->candidate);
+    }
+    else if (p_menu->editing && (p_item->param == offsetof(struct detector_params, threshold_adc2)
+                                 || p_item->param == offsetof(struct detector_params, close_adc2)))
+    {
+        level_adc2 = param_level(p_params, &p_det->cfar_adc2, p_menu->candidate);
+    }
 
-    static uint8_t f_left_cnt = 0;
-    static uint8_t left_cnt = 0;
-    static uint8_t center_cnt = 0;
-    static uint8_t right_cnt = 0;
-    static uint8_t f_right_cnt = 0;
+    bar_adc1 = margin_bar(p_det->signal_adc1, level_adc1);
+    bar_adc2 = margin_bar(p_det->signal_adc2, level_adc2);
+    set_LED(((0xFF00 << (8 - bar_adc1)) & 0xFF00) | (0x00FF >> (8 - bar_adc2)));
 
-    static uint8_t same_count = 0;
+    return;
+} // end of menu_preview
 
-    enum current_display {title_fleft, value_fleft, title_left, value_left, title_center, value_center, title_right, value_right, title_fright, value_fright};
+uint16_t strength_LED(q8_t strength, uint16_t LED_unit)
+{
+	// lights one LED from the left for every LED_unit of mV in strength, up to all 16
+    int32_t lit = 0;
 
-    static enum current_display state = title_left;
+    // a zero LED_unit means calibration saw nothing, there is no scale to show
+    if (LED_unit == 0)
+    {
+        return 0x0000;
+    }
+
+    lit = strength / q8_from_mv(LED_unit);
+    if (lit > 16)
+    {
+        lit = 16;
+    }
+
+    return 0xFFFF & ~(0xFFFF >> lit);
+} // end of strength_LED
+
+// a target has to be seen for at least this many main loop cycles while it crosses from under one
+// coil only to under the other only, otherwise there are too few samples for the position logic
+// and the zones between to follow it.
+#define min_samples_per_sweep 4
+
+// a measured lateral position past this either side counts as under that coil only. crossings are
+// timed between the two, the ratio of the drops is steep near the centre and says nothing about
+// the sweep rate there.
+#define crossing_edge 192
+
+// time in mS the sweep too fast warning stays on the SSD
+#define too_fast_hold_ms 500
+
+// output of the sweep position estimator, lateral, velocity and depth are Q8 fixed point
+struct position_estimate
+{
+    int32_t lateral;    // -256 is fully under the left coil (ADC1), 256 fully under the right coil (ADC2)
+    int32_t velocity;   // change in lateral position per main loop cycle
+    int32_t depth;      // relative depth, 256 is the depth at which the close thresholds trip
+    _Bool tracking;     // true while there is enough signal to estimate a position
+    uint8_t too_fast;   // main loop cycles left to hold the sweep too fast warning
+    int8_t side;        // -1 after the target was last under the left coil only, 1 the right, 0 neither yet
+    uint16_t crossing;  // main loop cycles since the target was last under one coil only
+};
+
+uint32_t cube_root(uint64_t value)
+{
+	// integer cube root, found one bit at a time from the top. values passed in here
+	// are below 2^40 so the root fits in 14 bits.
+    uint32_t root = 0;
+
+    for (uint32_t bit = 1 << 13; bit != 0; bit >>= 1)
+    {
+        uint64_t candidate = root | bit;
+        if (candidate * candidate * candidate <= value)
+        {
+            root |= bit;
+        }
+    }
+
+    return root;
+} // end of cube_root
+
+void update_position_estimate(struct position_estimate* p_est, const struct detector* p_det,
+                              const struct detector_params* p_params)
+{
+	// tracks where the target sits between the two coils from the ratio of the drops seen
+	// on each coil, and runs an alpha-beta filter over it so the sweep velocity comes out
+	// as well. the filter runs once per main loop cycle, so velocity is per cycle.
+	// pos_alpha sets how quickly the lateral position follows a new measurement, pos_beta
+	// how quickly the velocity follows.
+
+    // a target is there while either coil's signal is over its own detect level, the same
+    // signal and levels detection used this cycle, so with CFAR on a steady drop such as the
+    // ground is not tracked. half the deadzone either side keeps noise on the level from
+    // starting and stopping the track. the close levels are used as the reference depth.
+    q8_t edge_adc1 = p_est->tracking ? q8_sub(p_det->levels_adc1.detect, p_det->levels_adc1.half_deadzone)
+                                     : q8_add(p_det->levels_adc1.detect, p_det->levels_adc1.half_deadzone);
+    q8_t edge_adc2 = p_est->tracking ? q8_sub(p_det->levels_adc2.detect, p_det->levels_adc2.half_deadzone)
+                                     : q8_add(p_det->levels_adc2.detect, p_det->levels_adc2.half_deadzone);
+    _Bool has_target = q8_gt(p_det->signal_adc1, edge_adc1) || q8_gt(p_det->signal_adc2, edge_adc2);
+    q8_t close_reference = q8_max0((p_det->levels_adc1.close + p_det->levels_adc2.close) / 2);
+
+    // drop below the calibrated value on each coil in Q8, noise above the calibrated value is ignored
+    int32_t drop_left = q8_max0(p_det->drop_adc1);
+    int32_t drop_right = q8_max0(p_det->drop_adc2);
+    int32_t drop_total = drop_left + drop_right;
+
+    int32_t measured = 0;
+    int32_t residual = 0;
+
+    if (p_est->too_fast)
+    {
+        p_est->too_fast--;
+    }
+
+    // not enough signal to tell where the target is
+    if (!has_target || drop_total == 0)
+    {
+        p_est->tracking = false;
+        p_est->velocity = 0;
+        p_est->side = 0;
+        return;
+    }
+
+    // ratio of the drops, -256 when only the left coil sees the target and 256 when only the right does
+    measured = ((drop_right - drop_left) * 256) / drop_total;
+
+    if (!p_est->tracking)
+    {
+        // new target, start the filter on the first measurement
+        p_est->lateral = measured;
+        p_est->velocity = 0;
+        p_est->tracking = true;
+    }
+    else
+    {
+        residual = measured - (p_est->lateral + p_est->velocity);
+        p_est->lateral += p_est->velocity + (residual * p_params->pos_alpha) / 256;
+        p_est->velocity += (residual * p_params->pos_beta) / 256;
+
+        if (p_est->lateral > 256)
+        {
+            p_est->lateral = 256;
+        }
+        else if (p_est->lateral < -256)
+        {
+            p_est->lateral = -256;
+        }
+    }
+
+    // the coil response falls off with the cube of distance, so depth relative to where the
+    // close threshold trips is the cube root of the ratio of the two drops. 2^24 is 256 cubed,
+    // and both are already Q8.
+    p_est->depth = cube_root(((uint64_t)close_reference << 24) / drop_total);
+
+    // a target that went from under one coil only to under the other only in fewer than
+    // min_samples_per_sweep cycles crossed too fast to follow
+    if (measured <= -crossing_edge || measured >= crossing_edge)
+    {
+        int8_t side = (measured < 0) ? -1 : 1;
+
+        if (p_est->side == -side && p_est->crossing < min_samples_per_sweep)
+        {
+            p_est->too_fast = too_fast_hold_ms / p_params->loop_ms;
+        }
+        p_est->side = side;
+        p_est->crossing = 0;
+    }
+    else if (p_est->crossing < UINT16_MAX)
+    {
+        p_est->crossing++;
+    }
+
+    return;
+} // end of update_position_estimate
 
-    enum counter_list {fleft, left, cntr, right, fright, reset};
-    static enum counter_list previous_count = reset;
-    // logic to update the seen_counts variable based on current and previous ADC digital signals
+uint16_t position_pointer_LED(const struct position_estimate* p_est)
+{
+	// lights the LED above the estimated target centre, LED 15 is on the left side of the board
+    if (!p_est->tracking)
+    {
+        return 0x0000;
+    }
+
+    return 0x8000 >> (((p_est->lateral + 256) * 15) / 512);
+} // end of position_pointer_LED
+
+// how long the coil is pumped over the ground while the ground balance learns
+#define pump_ms 3000
+
+// the drop is smoothed over about this many main loop cycles while pumping, so the deepest point
+// of the pump is found from a few readings around the bottom rather than from one noisy one
+#define pump_smoothing 4
+
+enum ground_mode {gnd_off, gnd_manual, gnd_auto};
+
+// ground balance state, offsets are Q8 fixed point mV (256 = 1 mV)
+struct ground_balance
+{
+    int32_t offset_adc1;        // ground drop currently taken off each channel
+    int32_t offset_adc2;
+    uint16_t pump_cycles;       // main loop cycles left in a running pump, 0 when not pumping
+    int32_t pump_smooth_adc1;   // smoothed drop on each channel during the pump
+    int32_t pump_smooth_adc2;
+    int32_t pump_peak_adc1;     // largest smoothed drop so far, where the coil was lowest
+    int32_t pump_peak_adc2;
+};
+
+void ground_pump_start(struct ground_balance* p_ground, uint16_t loop_ms)
+{
+	// starts learning the ground. the coil is raised and lowered over clean ground for pump_ms
+	// while the deepest drop on each channel is found. the ground is learned at the bottom of
+	// the pump, where the coil is at sweep height.
+    p_ground->pump_cycles = pump_ms / loop_ms;
+    p_ground->pump_smooth_adc1 = 0;
+    p_ground->pump_smooth_adc2 = 0;
+    p_ground->pump_peak_adc1 = 0;
+    p_ground->pump_peak_adc2 = 0;
+
+    return;
+} // end of ground_pump_start
+
+_Bool ground_balance_apply(struct ground_balance* p_ground, struct detector_params* p_params, struct detector* p_det,
+                           const struct adc_frame* p_frame, uint16_t adc1_cal, uint16_t adc2_cal)
+{
+	// mineralised ground shows up as a drop on both coils that the thresholds would read as metal.
+	// the learned ground drop is handed to detection, which takes it off each channel's drop in
+	// Q8. the frame and the calibrated baselines are left alone. returns true on the cycle a
+	// pump finishes.
+
+    // drop below the calibrated value on each channel in Q8, negative when above it
+    int32_t drop_adc1 = ((int32_t)adc1_cal - p_frame->adc1) * 256;
+    int32_t drop_adc2 = ((int32_t)adc2_cal - p_frame->adc2) * 256;
+    _Bool pump_done = false;
+
+    if (p_ground->pump_cycles)
+    {
+        // the offsets stay frozen while the ground is being learned. the smoothing starts from
+        // the first reading, not from 0, so the start of the pump is not mistaken for its bottom.
+        if (p_ground->pump_cycles == pump_ms / p_params->loop_ms)
+        {
+            p_ground->pump_smooth_adc1 = drop_adc1;
+            p_ground->pump_smooth_adc2 = drop_adc2;
+        }
+        p_ground->pump_smooth_adc1 += (drop_adc1 - p_ground->pump_smooth_adc1) / pump_smoothing;
+        p_ground->pump_smooth_adc2 += (drop_adc2 - p_ground->pump_smooth_adc2) / pump_smoothing;
+        p_ground->pump_peak_adc1 = (p_ground->pump_smooth_adc1 > p_ground->pump_peak_adc1) ? p_ground->pump_smooth_adc1
+                                                                                          : p_ground->pump_peak_adc1;
+        p_ground->pump_peak_adc2 = (p_ground->pump_smooth_adc2 > p_ground->pump_peak_adc2) ? p_ground->pump_smooth_adc2
+                                                                                          : p_ground->pump_peak_adc2;
+
+        if (--p_ground->pump_cycles == 0)
+        {
+            // the drop at the bottom of the pump is the ground response at sweep height. the
+            // peaks start at 0, ground never raises the reading. the menu shows it to the mV.
+            p_ground->offset_adc1 = p_ground->pump_peak_adc1;
+            p_ground->offset_adc2 = p_ground->pump_peak_adc2;
+            p_params->gnd_offset_adc1 = (p_ground->offset_adc1 + 128) / 256;
+            p_params->gnd_offset_adc2 = (p_ground->offset_adc2 + 128) / 256;
+
+            // a pump turns the ground balance on if it was off
+            if (p_params->gnd_mode == gnd_off)
+            {
+                p_params->gnd_mode = gnd_manual;
+            }
+            pump_done = true;
+        }
+    }
+    else if (p_params->gnd_mode == gnd_auto)
+    {
+        // follow slow ground changes, but only while neither channel sees anything that could be
+        // metal, so a target is never balanced out. the levels are the last cycle's, compared with
+        // the drop left after the ground with CFAR off or the CFAR excess with it on.
+        q8_t signal_adc1 = p_params->cfar ? p_det->signal_adc1 : drop_adc1 - p_ground->offset_adc1;
+        q8_t signal_adc2 = p_params->cfar ? p_det->signal_adc2 : drop_adc2 - p_ground->offset_adc2;
+
+        if (signal_adc1 < activity_level(p_params, &p_det->levels_adc1)
+            && signal_adc2 < activity_level(p_params, &p_det->levels_adc2))
+        {
+            p_ground->offset_adc1 += (drop_adc1 - p_ground->offset_adc1) / (1 << p_params->gnd_track);
+            p_ground->offset_adc2 += (drop_adc2 - p_ground->offset_adc2) / (1 << p_params->gnd_track);
+        }
+    }
+    else if (p_params->gnd_mode == gnd_manual)
+    {
+        // the offsets in the menu are whole mV, a pump's offset is kept to the fraction until
+        // a different value is stored from the menu
+        if ((p_ground->offset_adc1 + 128) / 256 != p_params->gnd_offset_adc1)
+        {
+            p_ground->offset_adc1 = p_params->gnd_offset_adc1 * 256;
+        }
+        if ((p_ground->offset_adc2 + 128) / 256 != p_params->gnd_offset_adc2)
+        {
+            p_ground->offset_adc2 = p_params->gnd_offset_adc2 * 256;
+        }
+    }
+    else
+    {
+        p_ground->offset_adc1 = 0;
+        p_ground->offset_adc2 = 0;
+    }
+
+    p_det->ground_adc1 = p_ground->offset_adc1;
+    p_det->ground_adc2 = p_ground->offset_adc2;
+
+    return pump_done;
+} // end of ground_balance_apply
+
+// spectrum mode, a diagnostic that shows what interference sits on the coils. a window of
+// fft_points readings of each ADC is captured at fft_sample_hz and run through a fixed point FFT.
+#define fft_points 128
+#define fft_log2_points 7
+
+// 2 kHz keeps mains hum and its harmonics well below the 1 kHz the window can see, at 15.6 Hz per bin
+#define fft_sample_hz 2000
+
+// timer cycles a capture holds the main loop timer for, one period of fft_sample_hz per point
+#define fft_capture_cycles (fft_points * (100 * 1000 * 1000 / fft_sample_hz))
+
+// how often a new window is captured while in spectrum mode
+#define fft_every_ms 1000
+
+// number of dominant bins reported for each channel
+#define fft_num_peaks 3
+
+// sin(2*pi*k / fft_points) in Q15 for the first three quarters of a turn, both ends included.
+// the FFT twiddle factors and the Hann window are read from this, cos(x) being sin(x) a quarter
+// turn later. the Hann window reads cos(pi) at the centre of the window, which is the last entry.
+static const int16_t fft_sine[3 * fft_points / 4 + 1] =
+{
+         0,   1608,   3212,   4808,   6393,   7962,   9512,  11039,  12539,  14010,  15446,  16846,
+     18204,  19519,  20787,  22005,  23170,  24279,  25329,  26319,  27245,  28105,  28898,  29621,
+     30273,  30852,  31356,  31785,  32137,  32412,  32609,  32728,  32767,  32728,  32609,  32412,
+     32137,  31785,  31356,  30852,  30273,  29621,  28898,  28105,  27245,  26319,  25329,  24279,
+     23170,  22005,  20787,  19519,  18204,  16846,  15446,  14010,  12539,  11039,   9512,   7962,
+      6393,   4808,   3212,   1608,      0,  -1608,  -3212,  -4808,  -6393,  -7962,  -9512, -11039,
+    -12539, -14010, -15446, -16846, -18204, -19519, -20787, -22005, -23170, -24279, -25329, -26319,
+    -27245, -28105, -28898, -29621, -30273, -30852, -31356, -31785, -32137, -32412, -32609, -32728,
+    -32767,
+};
+
+// a dominant bin of a spectrum
+struct spectrum_peak
+{
+    uint16_t hz;            // centre frequency of the bin
+    uint32_t amplitude_uv;  // amplitude in uV of a sine at that frequency
+};
+
+struct spectrum
+{
+    uint16_t adc1[fft_points];      // the last captured window in mV
+    uint16_t adc2[fft_points];
+    int16_t re[fft_points];         // FFT working buffers, transformed in place
+    int16_t im[fft_points];
+    struct spectrum_peak peaks_adc1[fft_num_peaks];     // strongest first
+    struct spectrum_peak peaks_adc2[fft_num_peaks];
+    _Bool valid;                    // true once a window has been analysed
+    uint16_t due_cycles;            // main loop cycles until the next capture
+};
+
+void spectrum_capture(struct spectrum* p_spec)
+{
+	// reads both ADCs fft_points times, evenly spaced at fft_sample_hz. the burst borrows the
+	// main loop timer for fft_capture_cycles, 64 mS, so the main loop cycle it runs in is that
+	// much longer and the tick is handed over with tick_borrow() and restarted with tick_resync().
+    struct adc_frame sample;
+
+    for (int i = 0; i < fft_points; i++)
+    {
+        timer_dur = 100 * 1000 * 1000 / fft_sample_hz;
+        read_adc_frame(&sample);
+        p_spec->adc1[i] = sample.adc1;
+        p_spec->adc2[i] = sample.adc2;
+        wait_for_tick();
+    }
+
+    return;
+} // end of spectrum_capture
+
+void fft_q15(int16_t* p_re, int16_t* p_im)
+{
+	// in place radix-2 decimation in time FFT over fft_points Q15 values. every butterfly
+	// halves its outputs so nothing can overflow, the result is the transform divided by
+	// fft_points. inputs have to be below 2^14 in magnitude.
+    uint16_t j = 0;
+    int16_t swap = 0;
+
+    // reorder the input into bit reversed index order
+    for (uint16_t i = 1; i < fft_points; i++)
+    {
+        uint16_t bit = fft_points >> 1;
+        while (j & bit)
+        {
+            j ^= bit;
+            bit >>= 1;
+        }
+        j |= bit;
+
+        if (i < j)
+        {
+            swap = p_re[i]; p_re[i] = p_re[j]; p_re[j] = swap;
+            swap = p_im[i]; p_im[i] = p_im[j]; p_im[j] = swap;
+        }
+    }
+
+    // fft_log2_points stages, each combining pairs of transforms half points long
+    for (uint16_t half = 1, step = fft_points / 2; half < fft_points; half <<= 1, step >>= 1)
+    {
+        for (uint16_t k = 0; k < half; k++)
+        {
+            // twiddle factor e^(-2*pi*i*k*step / fft_points)
+            int32_t w_re = fft_sine[k * step + fft_points / 4];
+            int32_t w_im = -fft_sine[k * step];
+
+            for (uint16_t top = k; top < fft_points; top += 2 * half)
+            {
+                uint16_t bot = top + half;
+                int32_t t_re = (w_re * p_re[bot] - w_im * p_im[bot]) >> 15;
+                int32_t t_im = (w_re * p_im[bot] + w_im * p_re[bot]) >> 15;
+
+                p_re[bot] = (p_re[top] - t_re) >> 1;
+                p_im[bot] = (p_im[top] - t_im) >> 1;
+                p_re[top] = (p_re[top] + t_re) >> 1;
+                p_im[top] = (p_im[top] + t_im) >> 1;
+            }
+        }
+    }
+
+    return;
+} // end of fft_q15
+
+uint32_t square_root(uint32_t value)
+{
+	// integer square root, found one bit at a time from the top like cube_root
+    uint32_t root = 0;
+
+    for (uint32_t bit = 1 << 15; bit != 0; bit >>= 1)
+    {
+        uint32_t candidate = root | bit;
+        if (candidate * candidate <= value)
+        {
+            root |= bit;
+        }
+    }
+
+    return root;
+} // end of square_root
+
+void spectrum_analyse(struct spectrum* p_spec, const uint16_t* p_window, struct spectrum_peak* p_peaks)
+{
+	// finds the fft_num_peaks strongest local maxima in the spectrum of one captured window.
+	// the mean is taken off and the window scaled up as far as the FFT allows before a Hann
+	// window is applied, so small interference keeps its resolution next to a large baseline.
+    uint32_t sum = 0;
+    int32_t mean = 0;
+    int32_t peak_dev = 0;
+    int32_t dev = 0;
+    uint8_t shift = 0;
+    int32_t hann = 0;
+    uint16_t magnitude = 0;
+
+    for (int i = 0; i < fft_points; i++)
+    {
+        sum += p_window[i];
+    }
+    mean = sum / fft_points;
+
+    for (int i = 0; i < fft_points; i++)
+    {
+        dev = p_window[i] - mean;
+        dev = (dev < 0) ? -dev : dev;
+        peak_dev = (dev > peak_dev) ? dev : peak_dev;
+    }
+
+    while (shift < 14 && (peak_dev << (shift + 1)) < (1 << 14))
+    {
+        shift++;
+    }
+
+    for (int i = 0; i < fft_points; i++)
+    {
+        // the Hann window is symmetric, so only the first half of a turn of cos is needed
+        int index = (i <= fft_points / 2) ? i : fft_points - i;
+        hann = (32767 - fft_sine[index + fft_points / 4]) / 2;
 
-    _Bool is_right = !adc1 && adc2;
+        p_spec->re[i] = ((p_window[i] - mean) * (1 << shift) * hann) >> 15;
+        p_spec->im[i] = 0;
+    }
 
-    _Bool is_left = adc1 && !adc2;
+    fft_q15(p_spec->re, p_spec->im);
 
-    _Bool is_center = adc1 && adc2;
+    // magnitudes overwrite the real parts. bin 0 is the mean, which was taken off, and bins
+    // above fft_points / 2 mirror the ones below.
+    for (int k = 1; k < fft_points / 2; k++)
+    {
+        p_spec->re[k] = square_root(p_spec->re[k] * p_spec->re[k] + p_spec->im[k] * p_spec->im[k]);
+    }
 
+    for (int i = 0; i < fft_num_peaks; i++)
+    {
+        p_peaks[i].hz = 0;
+        p_peaks[i].amplitude_uv = 0;
+    }
 
-    // if metal is detected on both sensors
-    if (is_center)
+    for (int k = 1; k < fft_points / 2; k++)
     {
-        // to not count the same object twice in center_cnt
-        if (previous_count != cntr && same_count == 25)
+        magnitude = p_spec->re[k];
+
+        // one tone spreads over neighbouring bins, only the bin at the top counts
+        if ((k > 1 && magnitude <= p_spec->re[k - 1]) || (k < fft_points / 2 - 1 && magnitude < p_spec->re[k + 1]))
         {
-            center_cnt++;
-            previous_count = cntr;
-            same_count = 0;
+            continue;
         }
-        else
+
+        // a sine of amplitude A comes out of the window and FFT as A / 4
+        for (int i = 0; i < fft_num_peaks; i++)
         {
-        	same_count++;
+            uint32_t amplitude_uv = ((uint32_t)magnitude * 4 * 1000) >> shift;
+
+            if (amplitude_uv > p_peaks[i].amplitude_uv)
+            {
+                for (int move = fft_num_peaks - 1; move > i; move--)
+                {
+                    p_peaks[move] = p_peaks[move - 1];
+                }
+                p_peaks[i].hz = (k * fft_sample_hz + fft_points / 2) / fft_points;
+                p_peaks[i].amplitude_uv = amplitude_uv;
+                break;
+            }
         }
     }
 
-    // if metal is detected on left sensor only
-    else if (is_left)
+    return;
+} // end of spectrum_analyse
+
+_Bool spectrum_update(struct spectrum* p_spec, struct tick_state* p_tick, uint16_t loop_ms, _Bool telemetry)
+{
+	// captures and analyses a new window every fft_every_ms while spectrum mode is shown.
+	// the capture borrows the main loop timer, the tick restarts right after it so the time
+	// it took is counted exactly. returns true when it captured.
+    if (p_spec->due_cycles)
+    {
+        p_spec->due_cycles--;
+        return false;
+    }
+    p_spec->due_cycles = fft_every_ms / loop_ms;
+
+    tick_borrow(p_tick);
+    spectrum_capture(p_spec);
+    tick_resync(p_tick, fft_capture_cycles);
+    spectrum_analyse(p_spec, p_spec->adc1, p_spec->peaks_adc1);
+    spectrum_analyse(p_spec, p_spec->adc2, p_spec->peaks_adc2);
+    p_spec->valid = true;
+
+    if (telemetry)
     {
-        if (is_close)
+        // $FFT,<channel>,<Hz>,<uV>,<Hz>,<uV>,<Hz>,<uV>, dominant bins strongest first
+        for (int channel = 1; channel <= 2; channel++)
         {
-            if (previous_count != left && same_count == 25)
-            {
-                left_cnt++;
-                previous_count = left;
-                same_count = 0;
-            }
-            else
+            const struct spectrum_peak* p_peaks = (channel == 1) ? p_spec->peaks_adc1 : p_spec->peaks_adc2;
+            xil_printf("$FFT,%d", channel);
+            for (int i = 0; i < fft_num_peaks; i++)
             {
-            	same_count++;
+                xil_printf(",%d,%d", (int)p_peaks[i].hz, (int)p_peaks[i].amplitude_uv);
             }
+            xil_printf("\r\n");
         }
-        else
-        {
-            if (previous_count != fleft && same_count == 25)
-            {
-                f_left_cnt++;
-                previous_count = fleft;
-                same_count = 0;
-            }
-            else
-            {
-            	same_count++;
-            }
+    }
 
-        }
+    return true;
+} // end of spectrum_update
+
+const struct spectrum_peak* spectrum_strongest(const struct spectrum* p_spec)
+{
+	// the strongest interference seen on either coil
+    if (p_spec->peaks_adc2[0].amplitude_uv > p_spec->peaks_adc1[0].amplitude_uv)
+    {
+        return &p_spec->peaks_adc2[0];
     }
 
-    // if metal is detected on right sensor only
-    else if (is_right)
+    return &p_spec->peaks_adc1[0];
+} // end of spectrum_strongest
+
+uint16_t spectrum_LED(const struct spectrum* p_spec)
+{
+	// one LED for each 1/16 of the spectrum, lowest frequencies on the left. the bands holding
+	// a dominant bin of either coil are lit.
+    uint16_t led = 0;
+    uint16_t band_hz = (fft_sample_hz / 2) / 16;
+
+    for (int i = 0; i < fft_num_peaks; i++)
     {
-        if (is_close)
+        if (p_spec->peaks_adc1[i].amplitude_uv)
         {
-            if (previous_count != right && same_count == 25)
-            {
-                right_cnt++;
-                previous_count = right;
-                same_count = 0;
-            }
-            else
-            {
-            	same_count++;
-            }
+            led |= 0x8000 >> (p_spec->peaks_adc1[i].hz / band_hz);
         }
-        else
+        if (p_spec->peaks_adc2[i].amplitude_uv)
         {
-            if (previous_count != fright && same_count == 25)
-            {
-                f_right_cnt++;
-                previous_count = fright;
-                same_count = 0;
-            }
-            else
-            {
-            	same_count++;
-            }
+            led |= 0x8000 >> (p_spec->peaks_adc2[i].hz / band_hz);
         }
     }
-    else
+
+    return led;
+} // end of spectrum_LED
+
+uint16_t to_bcd(uint16_t value)
+{
+	// packs value into four decimal digits for the hex SSD mode, so 50 shows as 0050
+    uint16_t bcd = 0;
+
+    for (int digit = 0; digit < 4; digit++)
+    {
+        bcd |= (value % 10) << (4 * digit);
+        value /= 10;
+    }
+
+    return bcd;
+} // end of to_bcd
+
+// display compositor. each mode is a layout that puts views on the two halves of the SSD and on
+// the LEDs. a view is only redrawn when the data it shows changes, and printSSD() and set_LED()
+// then only touch the hardware when the combined result changes.
+enum view
+{
+    view_none,
+    view_zone,              // SSD, F.LFt, LEFt, Cntr, rght, F.rgt or ndEt
+    view_strength,          // SSD, total drop in mV in hex
+    view_strength_byte,     // SSD, total drop in mV in hex, clipped to FF to fit half the SSD
+    view_counts,            // SSD, title and count of each zone in turn, a second each
+    view_depth,             // SSD, depth in Q8 hex, 01.00 is where the close thresholds trip
+    view_target_id,         // SSD, Q8 ratio of high to low frequency response
+    view_spectrum,          // SSD, strongest interference in Hz
+    view_strength_bar,      // LEDs, one LED per LED_unit of total drop
+    view_pointer,           // LEDs, the LED above the target centre
+    view_bands,             // LEDs, spectrum bands holding interference
+    num_views
+};
+
+// a layout shows up to two time slices. each slice puts one view on the left two digits of the SSD
+// and one on the right two, the same view on both halves fills the SSD.
+struct layout
+{
+    uint8_t ssd_left[2];    // second slice is view_none when the layout does not time slice
+    uint8_t ssd_right[2];
+    uint8_t led;
+    _Bool hold;             // min and max hold markers over the LEDs
+};
+
+// each time slice stays on the SSD this long
+#define layout_slice_ms 1500
+
+// how long the min and max hold markers stay before they start following the strength again
+#define hold_ms 2000
+
+// everything the views draw from, gathered by the main loop each cycle
+struct view_data
+{
+    _Bool left;
+    _Bool right;
+    _Bool is_close;
+    q8_t strength;
+    uint16_t LED_unit;
+    const struct position_estimate* p_position;
+    const struct excitation* p_excite;
+    const struct zone_counter* p_counter;
+    const struct spectrum* p_spec;
+};
+
+// the last image drawn by a view and the data it was drawn from
+struct view_cache
+{
+    _Bool valid;
+    uint32_t key;
+    struct ssd_image image;     // LED views keep their LEDs in image.vector
+};
+
+// lowest and highest strength seen over the last hold_ms, in Q8 mV
+struct strength_hold
+{
+    q8_t min;
+    q8_t max;
+    uint16_t min_age;           // main loop cycles since min and max were set
+    uint16_t max_age;
+};
+
+struct compositor
+{
+    struct view_cache views[num_views];
+    const struct layout* p_layout;  // layout shown last cycle, the slices restart when it changes
+    uint8_t slice;
+    uint16_t slice_cycles;
+    uint32_t counts_cycles;         // cycles the counts view has been on the SSD
+    struct strength_hold hold;
+};
+
+void hold_update(struct strength_hold* p_hold, q8_t strength, uint16_t loop_ms)
+{
+	// a new min or max replaces the held one straight away, otherwise the held value is kept
+	// for hold_ms and then follows the strength
+    uint16_t hold_cycles = hold_ms / loop_ms;
+
+    if (strength >= p_hold->max || ++p_hold->max_age >= hold_cycles)
     {
-        previous_count = reset;
-        same_count = 0;
+        p_hold->max = strength;
+        p_hold->max_age = 0;
     }
 
-    if (mode_input == 2)
+    if (strength <= p_hold->min || ++p_hold->min_age >= hold_cycles)
     {
-        switch(state)
-        {
-        case title_fleft:
-            // F.lft
-            printSSD(RAW_DATA, 0b0001110100011100011100000111, 0b1000);
-            break;
+        p_hold->min = strength;
+        p_hold->min_age = 0;
+    }
 
-        case value_fleft:
-            printSSD(HEX_DATA, f_left_cnt, 0b0000);
-            break;
+    return;
+} // end of hold_update
 
-        case title_left:
-            // LEFt
-            printSSD(RAW_DATA, 0b1000111000011000011100000111, 0b0000);
-            break;
+uint16_t hold_LED(const struct strength_hold* p_hold, uint16_t LED_unit)
+{
+	// one LED at the top of the bar the held min and max would light
+    uint16_t bar_max = strength_LED(p_hold->max, LED_unit);
+    uint16_t bar_min = strength_LED(p_hold->min, LED_unit);
+
+    // the bar fills from the left, so its top is its lowest set bit
+    return (bar_max & -bar_max) | (bar_min & -bar_min);
+} // end of hold_LED
+
+uint32_t view_key(uint8_t view, const struct view_data* p_data, const struct compositor* p_comp, uint16_t loop_ms)
+{
+	// sums up the data a view draws from, the view is redrawn whenever this changes
+    const struct position_estimate* p_pos = p_data->p_position;
+    uint8_t page = 0;
+
+    switch (view)
+    {
+        case view_zone:
+            return p_data->left | (p_data->right << 1) | (p_data->is_close << 2);
+
+        case view_strength:
+        case view_strength_byte:
+            return p_data->strength / 256;
+
+        case view_counts:
+            // the title or count of one zone, changing once a second
+            page = (2 + (p_comp->counts_cycles * loop_ms) / 1000) % (2 * zone_none);
+            return (page << 8) | p_data->p_counter->counts[page / 2];
+
+        case view_depth:
+            return p_pos->tracking | ((uint32_t)p_pos->depth << 1);
+
+        case view_target_id:
+            return (p_data->left || p_data->right) ? (uint32_t)target_response_ratio(p_data->p_excite) : UINT32_MAX;
+
+        case view_spectrum:
+            return p_data->p_spec->valid ? spectrum_strongest(p_data->p_spec)->hz : UINT32_MAX;
+
+        case view_strength_bar:
+            return strength_LED(p_data->strength, p_data->LED_unit);
+
+        case view_pointer:
+            return position_pointer_LED(p_pos);
 
-        case value_left:
-            printSSD(HEX_DATA, left_cnt, 0b0000);
+        case view_bands:
+            return spectrum_LED(p_data->p_spec);
+
+        default:
+            return 0;
+    }
+} // end of view_key
+
+void view_render(uint8_t view, const struct view_data* p_data, uint32_t key, struct ssd_image* p_img)
+{
+	// draws a view. LED views put their LEDs in p_img->vector.
+    const struct position_estimate* p_pos = p_data->p_position;
+
+    // titles of the zones for the counts view, in enum zone order
+    static const struct ssd_image zone_titles[zone_none] =
+    {
+        {0b0001110100011100011100000111, 0b1000},   // F.LFt
+        {0b1000111000011000011100000111, 0b0000},   // LEFt
+        {0b1000110010101100001110101111, 0b0000},   // Cntr
+        {0b0101111001000000010110000111, 0b0000},   // rght
+        {0b0001110010111100100000000111, 0b1000},   // F.rgt
+    };
+
+    switch (view)
+    {
+        case view_zone:
+            zone_image(p_data->left, p_data->right, p_data->is_close, p_img);
             break;
 
-        case title_center:
-            // Cntr
-            printSSD(RAW_DATA, 0b1000110010101100001110101111, 0b0000);
+        case view_strength:
+            // strength is already clipped to 0 when the difference is only noise
+            hex_image(p_img, key, 0b0000);
             break;
 
-        case value_center:
-            printSSD(HEX_DATA, center_cnt, 0b0000);
+        case view_strength_byte:
+            hex_image(p_img, (key > 0xFF) ? 0xFF : key, 0b0000);
             break;
 
-        case title_right:
-            // rght
-            printSSD(RAW_DATA, 0b0101111001000000010110000111, 0b0000);
+        case view_counts:
+            // even pages are a zone title, odd pages its count
+            if (((key >> 8) & 1) == 0)
+            *p_img = zone_titles[(key >> 8) / 2];
+            else
+            hex_image(p_img, key & 0xFF, 0b0000);
             break;
 
-        case value_right:
-            printSSD(HEX_DATA, right_cnt, 0b0000);
+        case view_depth:
+            if (p_pos->tracking)
+            hex_image(p_img, (p_pos->depth > 0xFFFF) ? 0xFFFF : p_pos->depth, 0b0100);
+            else
+            // no target, ndet
+            set_image(p_img, 0b0101011010000100001100000111, 0b1000);
             break;
 
-        case title_fright:
-            // f.rgt
-            printSSD(RAW_DATA, 0b0001110010111100100000000111, 0b1000);
+        case view_target_id:
+            // above 01.00 the target behaves as a conductor, below it is ferrous
+            if (key != UINT32_MAX)
+            hex_image(p_img, key & 0xFFFF, 0b0100);
+            else
+            // no target, ndet
+            set_image(p_img, 0b0101011010000100001100000111, 0b1000);
             break;
 
-        case value_fright:
-            printSSD(HEX_DATA, f_right_cnt, 0b0000);
+        case view_spectrum:
+            // in decimal, SPEC until the first window has been analysed
+            if (key != UINT32_MAX)
+            hex_image(p_img, to_bcd(key), 0b0000);
+            else
+            // raw mode, vector says SPEC
+            set_image(p_img, 0b0010010000110000001101000110, 0b0000);
             break;
-        }
-    }
 
-    // 20 mS per main loop cycle, every 50 cycles is then 1 second, rotate state.
-    if ( (one_second_cntr++) == 50)
-    {
-        one_second_cntr = 0;
-        state = (state + 1) % 10;
+        default:
+            // the LED views, their key is the LEDs themselves
+            set_image(p_img, key, 0b0000);
+            break;
     }
 
     return;
-}
+} // end of view_render
 
-void set_detected_value(uint16_t *p_adc1_threshold, uint16_t *p_adc2_threshold)
+const struct ssd_image* view_image(struct compositor* p_comp, uint8_t view, const struct view_data* p_data, uint16_t loop_ms)
 {
-    // this function can set the threshold value for adc1 and adc2 individually.
-    // The threshold value is what the adc compares to against the default calibrated
-    // adc value for a metal detection.
-
-    // a detection is seen when the sampled adc value is less than the calibrated value
-    // minus its threshold, so the threshold determines the drop in mV necessary to detect metal.
-
-    // set
-    printSSD(RAW_DATA, 0b0010010000011000001111111111, 0b0000);
-    delay_n_secs(1);
+	// the image of a view, only redrawn when its key has changed since it was last drawn
+    struct view_cache* p_cache = &p_comp->views[view];
+    uint32_t key = view_key(view, p_data, p_comp, loop_ms);
 
-    //adc
-    printSSD(RAW_DATA, 0b001000010000110001101111111, 0b0000);
-    delay_n_secs(1);
+    if (!p_cache->valid || p_cache->key != key)
+    {
+        view_render(view, p_data, key, &p_cache->image);
+        p_cache->key = key;
+        p_cache->valid = true;
+    }
 
-    //trsh (threshold)
-    printSSD(RAW_DATA, 0b0000111010111100100100001011, 0b0001);
-    delay_n_secs(1);
+    return &p_cache->image;
+} // end of view_image
 
-    do
+void compose(struct compositor* p_comp, const struct layout* p_layout, const struct view_data* p_data, uint16_t loop_ms)
+{
+	// puts the views of a layout together on the SSD and LEDs for this main loop cycle
+    const struct ssd_image* p_left = NULL;
+    const struct ssd_image* p_right = NULL;
+    uint8_t view_left = view_none;
+    uint8_t view_right = view_none;
+    uint8_t dp = 0;
+    uint16_t led = 0;
+
+    if (p_layout != p_comp->p_layout)
     {
-        // 20 mS loop to update SSD display
-        timer_dur = 100 * 1000 * 20;
-
+        p_comp->p_layout = p_layout;
+        p_comp->slice = 0;
+        p_comp->slice_cycles = 0;
+    }
 
+    if (p_layout->ssd_left[1] != view_none && (++p_comp->slice_cycles) * loop_ms >= layout_slice_ms)
+    {
+        p_comp->slice ^= 1;
+        p_comp->slice_cycles = 0;
+    }
 
-        // if SW[0] is 0, set adc1 threshold value
-        if ( (SW & 0b1) == 0)
-        {
-            // first segment indicates ADC chosen, last three indicate current threshold value.
-            printSSD(HEX_DATA, (0b0001 << 12) | (pmod_counter & 0xFFF), 0b1000);
-        }
+    // the counts view only turns its pages while it can be seen
+    if (p_layout->ssd_left[p_comp->slice] == view_counts || p_layout->ssd_right[p_comp->slice] == view_counts)
+    {
+        p_comp->counts_cycles++;
+    }
 
-        // otherwise we set adc2 threshold value
-        else
-        {
-            // first segment indicates ADC chosen, last three indicate current threshold value.
-            printSSD(HEX_DATA, (0b0010 << 12) | (pmod_counter & 0xFFF), 0b1000);
-        }
+    view_left = p_layout->ssd_left[p_comp->slice];
+    view_right = p_layout->ssd_right[p_comp->slice];
+    p_left = view_image(p_comp, view_left, p_data, loop_ms);
+    p_right = view_image(p_comp, view_right, p_data, loop_ms);
 
-        while ((timer_state & 0b1) == 0) {}
-    }
-    while (!btn_U_deb());
+    // digits 3 and 2 from the left view, 1 and 0 from the right
+    dp = (p_left->dp_vector & 0b1100) | (p_right->dp_vector & 0b0011);
 
-    // if SW[0] = 0 set adc1
-    if ( (SW & 0b1) == 0)
+    // a sweep too fast to follow lights the last decimal point over the zone and depth views,
+    // which no view uses, so what they show can still be read
+    if (p_data->p_position->too_fast && (view_left == view_zone || view_left == view_depth
+                                         || view_right == view_zone || view_right == view_depth))
     {
-        *p_adc1_threshold = pmod_counter;
-        printSSD(RAW_DATA, 0b0001000010000110001101001111, 0b0000);
-        delay_n_secs(1);
-        printSSD(RAW_DATA, 0b0010010000011000001111111111, 0b0000);
-        delay_n_secs(1);
+        dp |= 0b0001;
     }
 
-    // else set adc2
-    else
+    printSSD(RAW_DATA, (p_left->vector & 0xFFFC000) | (p_right->vector & 0x3FFF), dp);
+
+    hold_update(&p_comp->hold, p_data->strength, loop_ms);
+
+    led = view_image(p_comp, p_layout->led, p_data, loop_ms)->vector;
+    if (p_layout->hold)
     {
-        *p_adc2_threshold = pmod_counter;
-        printSSD(RAW_DATA, 0b0001000010000110001100100100, 0b0000);
-        delay_n_secs(1);
-        printSSD(RAW_DATA, 0b0010010000011000001111111111, 0b0000);
-        delay_n_secs(1);
+        led |= hold_LED(&p_comp->hold, p_data->LED_unit);
     }
-    // reset timer_dur to not get caught in main loop waiting for timer_state
-    timer_dur = 1000;
+    set_LED(led);
 
     return;
-}
+} // end of compose
 
-void set_close_value(uint16_t* p_adc1_close_value, uint16_t* p_adc2_close_value)
-{
-    // this defines the value that an adc needs to see to be considered a close
-    // this decides whether to display "far left" or "left" for example.
+// how long without any signal or button activity before the low power mode goes idle
+#define idle_after_ms 5000
 
-    // set
-    printSSD(RAW_DATA, 0b0010010000011000001111111111, 0b0000);
-    delay_n_secs(1);
+// while idle, only one main loop cycle in this many samples the ADCs, the rest are skipped
+#define idle_sample_divider 4
 
-    //adc
-    printSSD(RAW_DATA, 0b001000010000110001101111111, 0b0000);
-    delay_n_secs(1);
+// how long the SSD and LEDs have to stay unchanged while idle before they are blanked
+#define blank_after_ms 10000
 
-    // clse. (close value)
-    printSSD(RAW_DATA, 0b1000110100011100100100000110, 0b0001);
-    delay_n_secs(1);
+enum power_mode {pwr_active, pwr_idle};
 
-    do
+// low power mode state, and energy accounting in main loop cycles spent in each state
+struct power_state
+{
+    enum power_mode mode;
+    uint16_t quiet_cycles;          // sampled cycles since the last signal or button activity
+    uint8_t skip;                   // idle cycles left to skip before the next sample
+    uint32_t active_cycles;         // cycles running at the full sample rate
+    uint32_t idle_sampled_cycles;   // idle cycles where the ADCs were sampled
+    uint32_t idle_skipped_cycles;   // idle cycles that only waited for the next tick, asleep under LOW_POWER_SLEEP
+};
+
+_Bool power_should_sample(struct power_state* p_power, _Bool low_power_enabled, _Bool wake)
+{
+	// decides at the start of a main loop cycle whether this cycle samples and processes the
+	// ADCs or just waits for the next one, and counts the cycle in the energy accounting. wake
+	// samples a cycle that would have been skipped, which starts a new idle period.
+    if (!low_power_enabled)
     {
-            // 20 mS loop to update SSD display
-        timer_dur = 100 * 1000 * 20;
+        p_power->mode = pwr_active;
+        p_power->quiet_cycles = 0;
+    }
 
+    if (p_power->mode == pwr_active)
+    {
+        p_power->active_cycles++;
+        return true;
+    }
 
-        // if SW[0] is 0, set adc1 close value
-        if ( (SW & 0b1) == 0)
-        {
-            // first segment indicates ADC chosen, last three indicate current threshold value.
-            printSSD(HEX_DATA, (0b0001 << 12) | (pmod_counter & 0xFFF), 0b1000);
-        }
+    if (p_power->skip && !wake)
+    {
+        p_power->skip--;
+        p_power->idle_skipped_cycles++;
+        return false;
+    }
 
-        // otherwise we set adc2 close value
-        else
+    p_power->skip = idle_sample_divider - 1;
+    p_power->idle_sampled_cycles++;
+    return true;
+} // end of power_should_sample
+
+void power_update(struct power_state* p_power, _Bool activity, _Bool low_power_enabled, uint16_t loop_ms)
+{
+	// any activity goes straight back to the full sample rate, so the very next main loop cycle
+	// is sampled. after idle_after_ms without activity the sample rate drops, but only with low
+	// power enabled, so the mode reported is always the one the cycles run in.
+    if (activity)
+    {
+        p_power->mode = pwr_active;
+        p_power->quiet_cycles = 0;
+        p_power->skip = 0;
+    }
+    else if (p_power->mode == pwr_active && low_power_enabled)
+    {
+        if (++p_power->quiet_cycles >= idle_after_ms / loop_ms)
         {
-            // first segment indicates ADC chosen, last three indicate current threshold value.
-            printSSD(HEX_DATA, (0b0010 << 12) | (pmod_counter & 0xFFF), 0b1000);
+            p_power->mode = pwr_idle;
         }
-
-        while ((timer_state & 0b1) == 0) {}
     }
-    while (!btn_D_deb());
 
-    // update adc1 close value
-    if ( (SW & 0b1) == 0)
-    {
-        *p_adc1_close_value = pmod_counter;
+    return;
+} // end of power_update
 
-        // adc1
-        printSSD(RAW_DATA, 0b0001000010000110001101001111, 0b0000);
-        delay_n_secs(1);
+void telemetry_jitter(struct tick_state* p_tick)
+{
+	// $JIT,<ticks>,<missed deadlines>,<resyncs>,<min slack>,<mean slack>,<max slack>
+	// slack is the number of timer polls spent waiting for each tick over the last report,
+	// so it shrinks as the work in a cycle grows. a min of 1 means a cycle only just made it.
+    uint32_t mean = p_tick->slack_count ? p_tick->slack_sum / p_tick->slack_count : 0;
 
-        // set
-        printSSD(RAW_DATA, 0b0010010000011000001111111111, 0b0000);
-        delay_n_secs(1);
-    }
+    xil_printf("$JIT,%d,%d,%d,%d,%d,%d\r\n", (int)p_tick->ticks, (int)p_tick->missed, (int)p_tick->resyncs,
+               p_tick->slack_count ? (int)p_tick->slack_min : 0, (int)mean, (int)p_tick->slack_max);
+    tick_stats_reset(p_tick);
 
-    // else update adc2 close value
-    else
-    {
-        *p_adc2_close_value = pmod_counter;
+    return;
+} // end of telemetry_jitter
 
-        // adc2
-        printSSD(RAW_DATA, 0b0001000010000110001100100100, 0b0000);
-        delay_n_secs(1);
+void telemetry_power(const struct power_state* p_power)
+{
+	// telemetry goes out over the UART while SW[0] is on. each line is a $ and a three letter
+	// record type followed by comma separated decimal fields.
+	// $PWR,<mode>,<active cycles>,<idle sampled cycles>,<idle skipped cycles>
+    xil_printf("$PWR,%d,%d,%d,%d\r\n", (int)p_power->mode, (int)p_power->active_cycles,
+               (int)p_power->idle_sampled_cycles, (int)p_power->idle_skipped_cycles);
 
-        // set
-        printSSD(RAW_DATA, 0b0010010000011000001111111111, 0b0000);
-        delay_n_secs(1);
+    return;
+} // end of telemetry_power
+
+// sample stream for the host visualizer, sent while SW[2] is on. every main loop cycle sends
+// the signal each coil is detected on and their states, the thresholds are only sent when they
+// change so the stream stays small enough for the UART at short loop periods.
+struct sample_stream
+{
+    _Bool levels_sent;                  // false until the thresholds have been sent since the stream started
+    struct channel_levels adc1;         // thresholds as last sent
+    struct channel_levels adc2;
+};
+
+_Bool level_moved(q8_t sent, q8_t now)
+{
+	// true when a threshold has moved by a mV or more since it was sent. fixed thresholds only
+	// move from the menu, CFAR ones move with the noise and would otherwise be sent every cycle.
+    return q8_gt(q8_sub(now, sent), 255) || q8_gt(q8_sub(sent, now), 255);
+} // end of level_moved
+
+_Bool levels_moved(const struct channel_levels* p_sent, const struct channel_levels* p_now)
+{
+	// true when any threshold of a coil has moved
+    return level_moved(p_sent->detect, p_now->detect) || level_moved(p_sent->close, p_now->close)
+           || level_moved(p_sent->half_deadzone, p_now->half_deadzone);
+} // end of levels_moved
+
+void stream_sample(struct sample_stream* p_stream, uint32_t time_ms, q8_t signal_adc1, q8_t signal_adc2,
+                   const struct channel_levels* p_adc1, const struct channel_levels* p_adc2,
+                   const struct detect_channel* p_left, const struct detect_channel* p_right)
+{
+	// $THR,<time mS>,<detect 1>,<close 1>,<half deadzone 1>,<detect 2>,<close 2>,<half deadzone 2>
+	// $SMP,<time mS>,<signal 1>,<signal 2>,<state>
+	// signals and thresholds are Q8. state has bit 0 for ADC1 detected, bit 1 for ADC1 close,
+	// bit 2 for ADC2 detected and bit 3 for ADC2 close.
+    if (!p_stream->levels_sent || levels_moved(&p_stream->adc1, p_adc1) || levels_moved(&p_stream->adc2, p_adc2))
+    {
+        xil_printf("$THR,%d,%d,%d,%d,%d,%d,%d\r\n", (int)time_ms, (int)p_adc1->detect, (int)p_adc1->close,
+                   (int)p_adc1->half_deadzone, (int)p_adc2->detect, (int)p_adc2->close, (int)p_adc2->half_deadzone);
+        p_stream->adc1 = *p_adc1;
+        p_stream->adc2 = *p_adc2;
+        p_stream->levels_sent = true;
     }
 
-    timer_dur = 1000;
+    xil_printf("$SMP,%d,%d,%d,%d\r\n", (int)time_ms, (int)signal_adc1, (int)signal_adc2,
+               p_left->detected | (p_left->close << 1) | (p_right->detected << 2) | (p_right->close << 3));
 
     return;
-}
+} // end of stream_sample
 
-#define deadzone_spacing 30
+#ifdef HOST_SIM
+// the host simulator has its own main() and runs the firmware from it
+#define main firmware_main
+#endif
 
 int main()
 {
 
-    enum mode {position, strength, num_objects};
+    // target id needs more than one excitation frequency, with one it is left out of the modes
+    enum mode
+    {
+        position,
+        strength,
+        num_objects,
+        locate,
+#if NUM_EXCITE_FREQS > 1
+        target_id,
+#endif
+        spectrum,
+        overview,
+        num_modes
+    };
+
+    // what each mode shows on the SSD and LEDs, see struct layout
+    static const struct layout layouts[num_modes] =
+    {
+        // position, F.LFt, LEFt, Cntr, rght, F.rgt on the SSD and strength on the LEDs
+        {{view_zone, view_none}, {view_zone, view_none}, view_strength_bar, false},
+        // strength, in hex on the SSD and on the LEDs with the min and max of the last 2 S marked
+        {{view_strength, view_none}, {view_strength, view_none}, view_strength_bar, true},
+        // num objects, each zone and the number of objects seen in it in turn
+        {{view_counts, view_none}, {view_counts, view_none}, view_strength_bar, false},
+        // locate, depth on the SSD and the LEDs pointing at the target centre
+        {{view_depth, view_none}, {view_depth, view_none}, view_pointer, false},
+#if NUM_EXCITE_FREQS > 1
+        // target id
+        {{view_target_id, view_none}, {view_target_id, view_none}, view_strength_bar, false},
+#endif
+        // spectrum, strongest interference in Hz and the bands it is in
+        {{view_spectrum, view_none}, {view_spectrum, view_none}, view_bands, false},
+        // overview, the start of the zone word next to the strength, then the depth. strength
+        // with min and max hold on the LEDs.
+        {{view_zone, view_depth}, {view_strength_byte, view_depth}, view_strength_bar, true},
+    };
 
     enum mode current_mode = position;
 
-    _Bool adc1_digital = false;
-    _Bool adc2_digital = false;
-
-    _Bool is_close = false;
-
-    _Bool is_close_left = false;
-    _Bool is_close_right = false;
+    // drops, CFAR state, thresholds and the ndet / far / close state of both coils.
+    // static, the CFAR cells are too big for the stack.
+    static struct detector detector;
 
     // these are the default voltage on the capacitors, set during calibration time when no metal is near the coils.
     uint16_t adc1_cal = 0;
     uint16_t adc2_cal = 0;
 
-    // these are the constantly sampled ADC values that will be updated during the main program loop
-    uint16_t adc1_val = 0;
-    uint16_t adc2_val = 0;
+    // both ADC channels sampled at the same instant, updated once per main loop
+    struct adc_frame frame;
+
+    // the coils read at each excitation frequency, the frame above is their average
+    struct excitation excite;
+
+    // settings start at their defaults and are changed from the menu
+    struct detector_params params = default_params;
+
+    // ground balance offsets and pump learning state
+    struct ground_balance ground = {0, 0, 0, 0, 0, 0, 0};
+
+    // state of the runtime menu, opened with the up or down button
+    struct menu_state menu = {false, false, 0, 0, 0, false, 0, 0};
+
+    // the buttons pressed during this main loop cycle
+    struct button_events buttons;
+
+    // true while the menu is drawing on the SSD and LEDs
+    _Bool menu_shown = false;
 
-    // default values for the threshold of seeing a left or right metal detected
-    uint16_t threshold_voltage_adc1 = 50;
-    uint16_t threshold_voltage_adc2 = 50;
+    // low power mode, switched on with SW[1]
+    struct power_state power = {pwr_active, 0, 0, 0, 0, 0};
+    _Bool low_power = false;
 
-    // default values for the threshold of seeing a close left or right metal detected
-    uint16_t is_close_threshold_adc1 = 100;
-    uint16_t is_close_threshold_adc2 = 100;
+    // main loop cycles since the last telemetry report
+    uint16_t telemetry_cycles = 0;
+
+    // the main loop period, with missed deadline counts and jitter statistics
+    struct tick_state tick;
+
+    // time since power up in mS, counted in main loop periods, for time stamping the detection log
+    uint32_t uptime_ms = 0;
+
+    // continuous lateral position, depth and sweep velocity of the target under the coils
+    struct position_estimate position_est = {0, 0, 0, false, 0, 0, 0};
+
+    // windows captured and analysed in spectrum mode. static, it is too big for the stack.
+    static struct spectrum spec;
+
+    // objects counted in each zone
+    struct zone_counter counter = {{0, 0, 0, 0, 0}, zone_none, 0};
+
+    // views drawn on the display and the data they are drawn from
+    static struct compositor compositor;
+    struct view_data view = {false, false, false, 0, 0, &position_est, &excite, &counter, &spec};
+
+    // coil, ADC and timer checks run at boot and on quiet cycles, and the faults they found
+    struct self_test selftest = {{0, 0, 0, 0, 0}, {0, 0, 0, 0, 0}, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+    uint8_t new_faults = 0;
 
     // These are used for setting the LED strength meter, updated after calibration
     uint16_t default_total = 0;
     uint16_t LED_unit = 0;
 
-    // prints "metal detector" on the seven segment display using rotation
-    print_title();
+    // samples and thresholds streamed to the host while SW[2] is on
+    struct sample_stream stream = {false, {0, 0, 0}, {0, 0, 0}};
+
+    // the timer is checked first, the title and the self-test are both paced by it
+    selftest_timer(&selftest);
+
+    // prints "metal detector" on the seven segment display using rotation, while the
+    // self-test checks the coils
+    print_title(&selftest);
+
+    // any fault found at boot is shown for a second before calibrating. a failed coil is
+    // calibrated as usual, its calibration is replaced with the working coil's from the first cycle.
+    if (SW & sw_telemetry_offset)
+    {
+        telemetry_selftest(&selftest);
+    }
+    if (selftest.faults)
+    {
+        selftest_show(selftest.faults);
+        delay_n_secs(1);
+    }
 
     // calibrates adc1_cal and adc2_cal variables for use in main loop
-    calibration(&adc1_cal, &adc2_cal);
+    calibration(&excite, &adc1_cal, &adc2_cal);
 
     // the default value that indicates no metal observed
     default_total = adc1_cal + adc2_cal;
@@ -840,177 +3333,195 @@ int main()
     // the drop in mV that corresponds to one of 16 LEDS, default_total normalized by 16
     LED_unit = default_total / 16;
 
+    // first tick of the main loop, 20 mS by default
+    tick_start(&tick, params.loop_ms);
+
     while(1)
     {
-        // 20 mS
-        timer_dur = 100 * 1000 * 20;
+        // loop period from the menu, takes effect from the next tick
+        tick_set_period(&tick, params.loop_ms);
+        uptime_ms += tick_take_ms(&tick);
 
-        // sampling on the ADC values in terms of mV
-        adc1_val = ((ADC1 >> 4) * 244 ) / 1000;
-        adc2_val = ((ADC2 >> 4) * 244 ) / 1000;
+        read_buttons(&buttons);
 
-        // debounced left button that sets the current mode enum
-        if (btn_L_deb())
+        low_power = (SW & sw_low_power_offset) != 0;
+
+        // energy accounting and loop jitter are reported once a second. telemetry and the log
+        // export are left for the next cycle when this one starts late.
+        if ((++telemetry_cycles) * params.loop_ms >= 1000 && !tick.shed)
         {
-            if (current_mode) // mode >= 0 (can go left)
+            telemetry_cycles = 0;
+            if (SW & sw_telemetry_offset)
             {
-                current_mode -= 1;
+                telemetry_power(&power);
+                telemetry_jitter(&tick);
             }
         }
 
-        // debounced right button that sets the current mode enum
-        if (btn_R_deb())
+        // a log export picked from the menu sends one line per cycle until it is done
+        if (!tick.shed)
         {
-            // cap mode to 2, since mode enum is size 3.
-            current_mode = (current_mode + 1) % 3;
+            log_export_tick(&hit_log);
         }
 
-        // debounced up button that calls the set detected values function, this allows one to change
-        // threshold voltage that is required for metal to be considered detected by either ADC
-        if (btn_U_deb())
+        // while idle in low power mode most cycles are skipped. a button press always wakes the
+        // detector up and is handled in this same cycle.
+        if (!power_should_sample(&power, low_power, buttons.up || buttons.down || buttons.left || buttons.right))
         {
-            set_detected_value(&threshold_voltage_adc1, &threshold_voltage_adc2);
+            display_tick(low_power && power.mode == pwr_idle, blank_after_ms / params.loop_ms);
+#ifdef HOST_SIM
+            // traces keep the skipped cycles too, for the time between the frames
+            host_trace_skip(adc1_cal, adc2_cal, params.loop_ms);
+#endif
+            tick_wait(&tick);
+            continue;
         }
 
-        // debounced down button that calls the set close values function, this allows one to change
-        // the threshold voltage that is required for metal to be considered detected, and close by either ADC
-        if (btn_D_deb())
+        // sampling both ADC values in terms of mV as one paired frame, at this cycle's excitation frequency
+        acquire_frame(&excite, &frame);
+
+#ifdef HOST_SIM
+        // the simulator can record every frame to a trace for the batch tool
+        host_trace_record(frame.adc1, frame.adc2, adc1_cal, adc2_cal, params.loop_ms);
+#endif
+
+        // the self-test keeps reading the coils, its noise figure only from cycles with nothing
+        // under them, and checks the timer from how long each tick was waited for. when it has
+        // enough it checks them. the check does not touch the timer, so it also runs in a cycle
+        // that began late, which is every cycle when the timer runs out straight away. only the
+        // report waits for a cycle that is on time.
+        if (selftest.count < selftest_samples)
         {
-            set_close_value(&is_close_threshold_adc1, &is_close_threshold_adc2);
+            selftest_sample(&selftest, &frame, !detector.left.detected && !detector.right.detected);
+            selftest_wait(&selftest, &tick);
         }
+        if (selftest.count == selftest_samples)
+        {
+            new_faults = selftest_evaluate(&selftest);
 
-        is_close = is_close_left || is_close_right;
-
+            if ((SW & sw_telemetry_offset) && !tick.shed)
+            {
+                telemetry_selftest(&selftest);
+            }
+            if (new_faults)
+            {
+                selftest.show_cycles = selftest_show_ms / params.loop_ms;
+            }
+        }
 
-        // updating the boolean signal for detecting metal on adc1
-        if (adc1_digital)
-        { // metal is detected case for adc1
+        // a failed coil is replaced by the working one from here on
+        selftest_degrade(&selftest, &excite, &frame, &adc1_cal, &adc2_cal);
 
-        	// metal is detected but far
-        	if (!is_close_left)
-        	{ // can either go to ndet or close
+        // a pump picked from the menu starts learning the ground
+        if (menu.action == menu_action_pump)
+        {
+            menu.action = 0;
+            ground_pump_start(&ground, params.loop_ms);
+        }
 
-        		// this checks if the deadzone has been passed and we want to go to ndet
-        		if (adc1_val > (adc1_cal - threshold_voltage_adc1 + deadzone_spacing / 2))
-        		{
-        			adc1_digital = false;
-        		}
+        // the detection log can be exported over the UART or cleared from the menu, SEt confirms either
+        else if (menu.action == menu_action_log_send || menu.action == menu_action_log_clear)
+        {
+            if (menu.action == menu_action_log_send)
+            {
+                log_export_start(&hit_log);
+            }
+            else
+            {
+                log_clear(&hit_log);
+            }
+            menu.action = 0;
+            menu.flash = 1000 / params.loop_ms;
+        }
 
-        		// this checks if the deadzone has been passed and we want to go to close right
-        		else if (adc1_val < (adc1_cal - is_close_threshold_adc1 - deadzone_spacing / 2))
-        		{
-        			is_close_left = true;
-        		}
-        	}
+        // learn or follow the ground response detection takes off both channels, and show SEt once a pump has finished
+        if (ground_balance_apply(&ground, &params, &detector, &frame, adc1_cal, adc2_cal) && menu.open)
+        {
+            menu.flash = 1000 / params.loop_ms;
+        }
 
-        	// metal is detected and close
-        	else
-        	{
-        		// this checks if the threshold above the dead zone has been reached
-        		if (adc1_val > (adc1_cal - is_close_threshold_adc1 + deadzone_spacing / 2))
-        		{
-        			is_close_left = false;
-        		}
-        	}
+        // debounced left button that sets the current mode enum, unless the menu is using the buttons
+        if (buttons.left && !menu.open)
+        {
+            if (current_mode) // mode >= 0 (can go left)
+            {
+                current_mode -= 1;
+            }
         }
 
-        else
-        { // in not detected case for adc1.
-
-        	// this checks if the drop past the dead zone has been reached
-        	if (adc1_val < (adc1_cal - threshold_voltage_adc1 - deadzone_spacing / 2))
-        	{
-        		// set digital to true to get a far output.
-        		adc1_digital = true;
-        	}
-        }
-
-        //updating the boolean signal for detecting metal on adc2
-        if (adc2_digital)
-        { // metal is detected case for adc2
-
-        	// metal is detected but far
-        	if (!is_close_right)
-        	{ // can either go to ndet or close
-
-        		// this checks if the deadzone has been passed and we want to go to ndet
-        		if (adc2_val > (adc2_cal - threshold_voltage_adc2 + deadzone_spacing / 2))
-        		{
-        			adc2_digital = false;
-        		}
-
-        		// this checks if the deadzone has been passed and we want to go to close right
-        		else if (adc2_val < (adc2_cal - is_close_threshold_adc2 - deadzone_spacing / 2))
-        		{
-        			is_close_right = true;
-        		}
-        	}
-
-        	// metal is detected and close
-        	else
-        	{
-        		// this checks if the threshold above the dead zone has been reached
-        		if (adc2_val > (adc2_cal - is_close_threshold_adc2 + deadzone_spacing / 2))
-        		{
-        			is_close_right = false;
-        		}
-        	}
+        // debounced right button that sets the current mode enum
+        else if (buttons.right && !menu.open)
+        {
+            // wrap back around to the first mode after the last one
+            current_mode = (current_mode + 1) % num_modes;
         }
 
-        else
-        { // in not detected case for adc2.
+        // the detection state of both coils from this cycle's frame
+        detector_update(&detector, &params, &frame, adc1_cal, adc2_cal);
 
-        	// this checks if the drop past the dead zone has been reached
-        	if (adc2_val < (adc2_cal - threshold_voltage_adc2 - deadzone_spacing / 2))
-        	{
-        		// set digital to true to get a far output.
-        		adc2_digital = true;
-        	}
+        // the host visualizer gets every sample. the thresholds are sent again whenever the
+        // stream is switched back on, and no lines go out in a cycle that began late.
+        if ((SW & sw_stream_offset) && !tick.shed)
+        {
+            stream_sample(&stream, uptime_ms, detector.signal_adc1, detector.signal_adc2, &detector.levels_adc1,
+                          &detector.levels_adc2, &detector.left, &detector.right);
         }
-
-        // checks that the ADC difference is positive due to noise in ADC signal
-        if (default_total - adc1_val - adc2_val > 0)
+        else if (!(SW & sw_stream_offset))
         {
-        	// if the difference is positive, take the difference and normalize it by LED_unit
-        	// and set LED such that each LED_unit of mV seen lights up an LED
-            LED = 0xFFFF & ~(0xFFFF >> ((default_total - adc1_val - adc2_val) / LED_unit));
+            stream.levels_sent = false;
         }
 
-        else
+        // every detection goes into the log once both coils have lost it
+        log_update(&hit_log, detector.left.detected, detector.right.detected, detector.is_close,
+                   detector.strength_total / 256, &params, uptime_ms);
+
+        update_position_estimate(&position_est, &detector, &params);
+
+        // the up and down buttons open the menu, which then takes over the SSD and LEDs
+        // until it is closed. detection above keeps running the whole time.
+        menu_shown = menu_update(&menu, &params, &buttons);
+        menu_preview(&menu, &params, &detector);
+
+        // in spectrum mode a new window is captured about once a second, on the timer borrowed
+        // from the tick. no capture is started in a cycle that began late.
+        if (current_mode == spectrum && !menu_shown && !tick.shed)
         {
-        	// otherwise if ADC difference due to noise is negative just blank out LEDs
-            LED = 0x0000;
+            spectrum_update(&spec, &tick, params.loop_ms, (SW & sw_telemetry_offset) != 0);
         }
 
-        // based on the current_mode enumeration the information displayed on the seven segment display differs.
-        switch (current_mode)
-        {
-            case position:
-                // position mode, prints F.LFt, LEFt, Cntr, rght, F.rgt
-                // depending on digitalized adc value readings, and is_close bool.
-                update_SSD_data(adc1_digital, adc2_digital, is_close);
-            break;
+        // objects are counted every cycle, whether or not the counts are on the display
+        zone_count_update(&counter, detector.left.detected, detector.right.detected, detector.is_close, params.loop_ms);
 
-            case strength:
-                // strength mode, prints a numeric value in HEX of the ADC calibrated values
-                // minus their current values (metallic object decreases observed voltage on coils)
-            	// again an if is used to check that the difference is positive due to noise on ADC inputs
-                if (default_total - (adc1_val + adc2_val) > 0)
-                printSSD(HEX_DATA, (default_total - (adc1_val + adc2_val)), 0b0000);
-                else
-                // clips lower bound to 0 in case of overflow (will show 0xF... on SSD)
-                printSSD(HEX_DATA, 0b0000, 0b0000);
-            break;
-            default:
-                // we dont care what this does in current_mode = num_objects since the function is calculated at all times
-            break;
+        // the menu has the SSD and LEDs while it is open, then a fault the self-test has just
+        // found, otherwise they show the views in the layout of the current mode
+        if (!menu_shown && selftest.show_cycles && (selftest.faults | selftest.degraded))
+        {
+            selftest.show_cycles--;
+            selftest_show(selftest.faults | selftest.degraded);
         }
-        // this counts number of objects seen, it must be calculated every cycle.
-        // whether or not this actually outputs depends on the current_mode input
-        print_num_objects_SSD(adc1_digital, adc2_digital, is_close, current_mode);
+        else if (!menu_shown)
+        {
+            view.left = detector.left.detected;
+            view.right = detector.right.detected;
+            view.is_close = detector.is_close;
+            view.strength = detector.strength_total;
+            view.LED_unit = LED_unit;
+            compose(&compositor, &layouts[current_mode], &view, params.loop_ms);
+        }
+
+        // a signal rising towards a threshold, a detection, the menu or a button press all count
+        // as activity and keep the detector at the full sample rate
+        power_update(&power, detector.left.detected || detector.right.detected || menu.open || ground.pump_cycles
+                             || buttons.up || buttons.down || buttons.left || buttons.right
+                             || q8_gt(detector.signal_adc1, activity_level(&params, &detector.levels_adc1))
+                             || q8_gt(detector.signal_adc2, activity_level(&params, &detector.levels_adc2)),
+                     low_power, params.loop_ms);
+
+        // unchanged displays are blanked while idle
+        display_tick(low_power && power.mode == pwr_idle, blank_after_ms / params.loop_ms);
 
-        // wait until timer is the correct value to ensure a main loop frequency of 50 Hz
-        while((timer_state & 0b1) == 0){}
+        // wait for the next tick, the main loop runs once every loop_ms
+        tick_wait(&tick);
     }
     return 0;
 }
@@ -0,0 +1,199 @@
+// benchmark of the spectrum mode FFT. fft_q15() from helloworld.c is run over synthetic windows
+// on the host, timed per window, and checked against a double precision DFT of the same input.
+// spectrum_analyse() is then checked on captured windows with known tones, which covers the
+// Hann window and the peak picking as well. exits with 1 if any check fails.
+//
+// build from the repository root:
+//   cc -O2 -DHOST_SIM -Ihost host/fft_bench.c host/host_hw.c -lm -o fft_bench
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// the firmware is built into the bench whole, for struct spectrum and everything that uses it
+#include "../helloworld.c"
+#undef main
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define bench_has_tsc 1
+#else
+#define bench_has_tsc 0
+#endif
+
+#define bench_points fft_points
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static uint64_t now_cycles(void)
+{
+#if bench_has_tsc
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static void make_window(int16_t* p_re, int16_t* p_im, unsigned seed)
+{
+	// two tones and some noise, peaking just under the 2^14 fft_q15() accepts
+    srand(seed);
+    for (int i = 0; i < bench_points; i++)
+    {
+        double x = 9000.0 * sin(2.0 * M_PI * 3.2 * i / bench_points)
+                   + 4000.0 * sin(2.0 * M_PI * 19.0 * i / bench_points + 1.0)
+                   + (rand() % 2001 - 1000);
+        p_re[i] = (int16_t)lround(x);
+        p_im[i] = 0;
+    }
+}
+
+static double error_db(const int16_t* p_in, const int16_t* p_re, const int16_t* p_im)
+{
+	// power of the difference between fft_q15() and an exact DFT scaled by 1 / bench_points,
+	// relative to the power of the exact result
+    double signal = 0;
+    double error = 0;
+
+    for (int k = 0; k < bench_points; k++)
+    {
+        double re = 0;
+        double im = 0;
+
+        for (int n = 0; n < bench_points; n++)
+        {
+            re += p_in[n] * cos(2.0 * M_PI * k * n / bench_points);
+            im -= p_in[n] * sin(2.0 * M_PI * k * n / bench_points);
+        }
+        re /= bench_points;
+        im /= bench_points;
+
+        signal += re * re + im * im;
+        error += (re - p_re[k]) * (re - p_re[k]) + (im - p_im[k]) * (im - p_im[k]);
+    }
+
+    return 10.0 * log10(error / signal);
+}
+
+static void tone_window(uint16_t* p_window, double baseline_mv, double mv, double hz, double mv2, double hz2)
+{
+	// a captured window of up to two tones on a baseline, in whole mV like the ADC readings
+    for (int i = 0; i < bench_points; i++)
+    {
+        double t = (double)i / fft_sample_hz;
+
+        p_window[i] = (uint16_t)lround(baseline_mv + mv * sin(2.0 * M_PI * hz * t) + mv2 * sin(2.0 * M_PI * hz2 * t + 0.5));
+    }
+}
+
+static int check_peak(const char* p_name, const struct spectrum_peak* p_peak, uint16_t hz, double uv, double tolerance)
+{
+	// 1 if a reported peak is in the expected bin with an amplitude within tolerance of uv
+    int ok = p_peak->hz == hz && fabs(p_peak->amplitude_uv - uv) <= tolerance * uv;
+
+    printf("  %-34s %4u Hz %6u uV, expected %4u Hz %6.0f uV  %s\n", p_name, (unsigned)p_peak->hz,
+           (unsigned)p_peak->amplitude_uv, (unsigned)hz, uv, ok ? "ok" : "FAIL");
+
+    return ok;
+}
+
+static int check_spectrum(void)
+{
+	// spectrum_analyse() on windows whose content is known, returns 1 if every check passed
+    static struct spectrum spec;
+    static uint16_t window[bench_points];
+    struct spectrum_peak peaks[fft_num_peaks];
+    int ok = 1;
+    int flat = 1;
+
+    printf("spectrum_analyse:\n");
+
+    // a tone in the middle of a bin comes out at its full amplitude
+    tone_window(window, 600, 20, 16.0 * fft_sample_hz / bench_points, 0, 0);
+    spectrum_analyse(&spec, window, peaks);
+    ok &= check_peak("20 mV at 250 Hz", &peaks[0], 250, 20000, 0.05);
+
+    // mains hum between bins loses up to 1.4 dB to the Hann window, a smaller tone is second
+    tone_window(window, 800, 5, 50, 2, 28.0 * fft_sample_hz / bench_points);
+    spectrum_analyse(&spec, window, peaks);
+    ok &= check_peak("5 mV of 50 Hz hum", &peaks[0], 47, 5000, 0.2);
+    ok &= check_peak("2 mV at 437.5 Hz next to it", &peaks[1], 438, 2000, 0.2);
+
+    // an impulse at the centre of the window, where the Hann weight is 1, has a flat spectrum.
+    // every bin comes out at the impulse / fft_points after the scaling in spectrum_analyse().
+    for (int i = 0; i < bench_points; i++)
+    {
+        window[i] = 500;
+    }
+    window[bench_points / 2] = 600;
+    spectrum_analyse(&spec, window, peaks);
+    for (int k = 1; k < bench_points / 2; k++)
+    {
+        flat &= abs(spec.re[k] - 100) <= 1;
+    }
+    printf("  %-34s bin 1 %d, bin 63 %d, expected 100  %s\n", "impulse at the window centre", spec.re[1],
+           spec.re[bench_points / 2 - 1], flat ? "ok" : "FAIL");
+
+    return ok && flat;
+}
+
+int main(int argc, char** argv)
+{
+    int windows = (argc > 1) ? atoi(argv[1]) : 200000;
+    static int16_t input[bench_points];
+    static int16_t re[bench_points];
+    static int16_t im[bench_points];
+    double start_ns = 0;
+    double total_ns = 0;
+    uint64_t start_cycles = 0;
+    uint64_t total_cycles = 0;
+    long checksum = 0;
+
+    if (windows <= 0)
+    {
+        fprintf(stderr, "usage: %s [windows]\n", argv[0]);
+        return 2;
+    }
+
+    make_window(input, im, 1);
+    for (int i = 0; i < bench_points; i++)
+    {
+        re[i] = input[i];
+    }
+    fft_q15(re, im);
+    printf("points %d, error against exact DFT %.1f dB\n", bench_points, error_db(input, re, im));
+
+    for (int w = 0; w < windows; w++)
+    {
+        for (int i = 0; i < bench_points; i++)
+        {
+            re[i] = input[i];
+            im[i] = 0;
+        }
+
+        start_ns = now_ns();
+        start_cycles = now_cycles();
+        fft_q15(re, im);
+        total_cycles += now_cycles() - start_cycles;
+        total_ns += now_ns() - start_ns;
+
+        // keeps the compiler from dropping transforms nobody looks at
+        checksum += re[w % bench_points];
+    }
+
+    printf("windows %d, %.1f ns per window", windows, total_ns / windows);
+    if (bench_has_tsc)
+    {
+        printf(", %.0f TSC cycles per window", (double)total_cycles / windows);
+    }
+    printf(" (checksum %ld)\n", checksum);
+
+    return check_spectrum() ? 0 : 1;
+}
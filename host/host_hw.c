@@ -0,0 +1,322 @@
+// host model of the detector hardware. time only moves forward while the firmware waits on the
+// timer or reads an ADC, so a simulated run takes a fraction of the real time it covers.
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host_hw.h"
+
+// the board runs at 100 MHz, timer_dur counts in these cycles
+#define host_clock_hz 100000000.0
+
+// each ADC register read takes this many cycles on the bus
+#define host_adc_read_cycles 100
+
+// the XADC sequencer converts ADC1 and ADC2 in turn at 1 MSPS, so each channel gets a new
+// conversion every this many cycles, ADC2 half of it after ADC1
+#define host_adc_sequence_cycles 200
+
+// and each poll of timer_state this many, counting the loop around it
+#define host_timer_poll_cycles 20
+
+// the XADC reads 244 uV per LSB, the 12 bit result sits in the top of the 16 bit register
+#define host_uv_per_lsb 244.0
+
+struct host_hw_regs host_hw;
+struct host_config host_cfg;
+
+static uint64_t now_cycles;
+static uint64_t timer_start;
+static unsigned timer_cycles;
+static uint64_t noise_state = 0x9E3779B97F4A7C15ull;
+
+// latest conversion of each channel and the sequencer step it was made in, so reading a result
+// register again before the next conversion returns the same reading, noise and all
+static uint64_t adc_step[2] = {UINT64_MAX, UINT64_MAX};
+static long adc_code[2];
+
+double host_hw_seconds(void)
+{
+    return now_cycles / host_clock_hz;
+}
+
+static double noise_gauss(void)
+{
+	// xorshift generator so every run with the same options gives the same readings,
+	// turned into a normal distribution with Box-Muller
+    double u1 = 0;
+    double u2 = 0;
+
+    for (int i = 0; i < 2; i++)
+    {
+        noise_state ^= noise_state << 13;
+        noise_state ^= noise_state >> 7;
+        noise_state ^= noise_state << 17;
+        if (i == 0)
+        {
+            u1 = ((noise_state >> 11) + 1.0) / 9007199254740993.0;
+        }
+        else
+        {
+            u2 = (noise_state >> 11) / 9007199254740992.0;
+        }
+    }
+
+    return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+double host_target_drop(const struct host_target* p_target, double coil_x_mm, double freq_khz)
+{
+	// drop in mV a target causes on a coil at coil_x_mm when driven at freq_khz. the eddy current
+	// part follows the usual single pole response w*tau / sqrt(1 + (w*tau)^2) and rises with
+	// frequency. the ferrous part is strongest at low frequency and is shielded by the target's
+	// own eddy currents as frequency rises. both are scaled to 50 mm and fall off with distance cubed.
+    double dx = coil_x_mm - p_target->x_mm;
+    double r2 = dx * dx + p_target->depth_mm * p_target->depth_mm;
+    double geometry = pow(50.0 * 50.0 / r2, 1.5);
+    double wt = 2.0 * M_PI * freq_khz * 1000.0 * p_target->tau_us * 1e-6;
+    double eddy = p_target->size_mv * wt / sqrt(1.0 + wt * wt);
+    double ferrous = p_target->ferrous_mv / sqrt(1.0 + wt * wt);
+
+    return geometry * (eddy + ferrous);
+}
+
+static double coil_mv(int channel, double t)
+{
+	// reading of coil 1 (left) or 2 (right) at time t
+    double head_x = host_cfg.sweep_mm * sin(2.0 * M_PI * host_cfg.sweep_hz * t);
+    double coil_x = head_x + ((channel == 1) ? -host_cfg.coil_mm : host_cfg.coil_mm);
+    unsigned slot = host_hw.excite_sel;
+    double freq = host_cfg.freq_khz[(slot < (unsigned)host_cfg.num_freqs) ? slot : 0];
+    double mv = host_cfg.baseline_mv;
+
+    for (int i = 0; i < host_cfg.num_events; i++)
+    {
+        if (host_cfg.events[i].kind == 'O' && host_cfg.events[i].value == (unsigned)channel
+            && t >= host_cfg.events[i].t)
+        {
+            return 0;
+        }
+    }
+
+    if (t >= host_cfg.appear_s)
+    {
+        mv -= host_cfg.ground_mv;
+        for (int i = 0; i < host_cfg.num_targets; i++)
+        {
+            mv -= host_target_drop(&host_cfg.targets[i], coil_x, freq);
+        }
+    }
+
+    mv += host_cfg.hum_mv * sin(2.0 * M_PI * host_cfg.hum_hz * t);
+    mv += host_cfg.noise_mv * noise_gauss();
+
+    return mv;
+}
+
+int host_hw_adc(int channel)
+{
+	// the result register of channel 1 or 2, which holds the sequencer's latest conversion
+    uint64_t offset = (channel == 1) ? 0 : host_adc_sequence_cycles / 2;
+    uint64_t step = (now_cycles < offset) ? 0 : (now_cycles - offset) / host_adc_sequence_cycles;
+    int index = (channel == 1) ? 0 : 1;
+
+    if (step != adc_step[index])
+    {
+        double mv = coil_mv(channel, (step * host_adc_sequence_cycles + offset) / host_clock_hz);
+        long code = lround(mv * 1000.0 / host_uv_per_lsb);
+
+        adc_step[index] = step;
+        adc_code[index] = (code < 0) ? 0 : ((code > 0xFFF) ? 0xFFF : code);
+    }
+
+    now_cycles += host_adc_read_cycles;
+
+    return (int)(adc_code[index] << 4);
+}
+
+static char segment_char(unsigned segments)
+{
+	// turns one digit of raw SSD data (active low, bit 6 is segment g, bit 0 is segment a) back
+	// into the character it draws
+    static const struct { unsigned lit; char ch; } table[] =
+    {
+        {0x3F, '0'}, {0x06, '1'}, {0x5B, '2'}, {0x4F, '3'}, {0x66, '4'}, {0x6D, 'S'}, {0x7D, '6'},
+        {0x07, '7'}, {0x7F, '8'}, {0x6F, '9'}, {0x77, 'A'}, {0x7C, 'b'}, {0x39, 'C'}, {0x58, 'c'},
+        {0x5E, 'd'}, {0x79, 'E'}, {0x7B, 'e'}, {0x71, 'F'}, {0x74, 'h'}, {0x76, 'H'}, {0x30, 'I'},
+        {0x10, 'i'}, {0x38, 'L'}, {0x54, 'n'}, {0x5C, 'o'}, {0x73, 'P'}, {0x50, 'r'}, {0x78, 't'},
+        {0x3E, 'U'}, {0x1C, 'u'}, {0x6E, 'y'}, {0x40, '-'}, {0x08, '_'}, {0x00, ' '}, {0x31, 'T'}, {0x3D, 'G'},
+    };
+    unsigned lit = ~segments & 0x7F;
+
+    for (size_t i = 0; i < sizeof(table) / sizeof(table[0]); i++)
+    {
+        if (table[i].lit == lit)
+        {
+            return table[i].ch;
+        }
+    }
+
+    return '?';
+}
+
+static void show_display(void)
+{
+	// prints the SSD and LEDs whenever either changes
+    static struct host_hw_regs shown;
+    static int shown_once = 0;
+    char text[5];
+
+    if (shown_once && shown.led == host_hw.led && shown.ssd_hex == host_hw.ssd_hex
+        && shown.ssd_raw_top == host_hw.ssd_raw_top && shown.ssd_raw_bot == host_hw.ssd_raw_bot
+        && shown.ssd_mode_dp == host_hw.ssd_mode_dp)
+    {
+        return;
+    }
+    shown = host_hw;
+    shown_once = 1;
+
+    if (host_hw.ssd_mode_dp & 0x10)
+    {
+        snprintf(text, sizeof(text), "%04X", host_hw.ssd_hex & 0xFFFF);
+    }
+    else
+    {
+        uint32_t raw = ((host_hw.ssd_raw_top & 0x3FFF) << 14) | (host_hw.ssd_raw_bot & 0x3FFF);
+        for (int digit = 0; digit < 4; digit++)
+        {
+            text[digit] = segment_char(raw >> (7 * (3 - digit)));
+        }
+        text[4] = '\0';
+    }
+
+    fprintf(stderr, "%9.3f SSD [%s] dp %X LED %04X\n", host_hw_seconds(), text,
+            host_hw.ssd_mode_dp & 0xF, host_hw.led & 0xFFFF);
+}
+
+unsigned* host_hw_timer_dur(void)
+{
+    timer_start = now_cycles;
+    return &timer_cycles;
+}
+
+unsigned host_hw_timer_state(void)
+{
+	// every poll of a running timer takes host_timer_poll_cycles, so the number of polls spent
+	// waiting is what it would be on the board. a timer that ran out before the first poll reads
+	// done straight away, which is how the firmware spots a missed deadline. the rest of the
+	// model only has to catch up once the timer is done.
+    if (now_cycles < timer_start + timer_cycles)
+    {
+        now_cycles += host_timer_poll_cycles;
+        return 0;
+    }
+
+    if (host_cfg.show_display)
+    {
+        show_display();
+    }
+
+    if (host_hw_seconds() >= host_cfg.seconds)
+    {
+        // exit() closes the trace file along with everything else
+        fflush(stdout);
+        exit(0);
+    }
+
+    for (int i = 0; i < host_cfg.num_events; i++)
+    {
+        if (host_cfg.events[i].kind == 'S' && host_hw_seconds() >= host_cfg.events[i].t)
+        {
+            host_hw.sw = host_cfg.events[i].value;
+        }
+    }
+
+    return 0b1;
+}
+
+static void host_trace_write(struct host_trace_frame frame, unsigned adc1_cal, unsigned adc2_cal, unsigned loop_ms)
+{
+	// the header is written with the first frame, once calibration is done
+    static FILE* p_file = NULL;
+
+    if (host_cfg.p_trace == NULL)
+    {
+        return;
+    }
+
+    if (p_file == NULL)
+    {
+        struct host_trace_header header = {{0}, (uint16_t)loop_ms, (uint16_t)adc1_cal, (uint16_t)adc2_cal, 0};
+
+        p_file = fopen(host_cfg.p_trace, "wb");
+        if (p_file == NULL)
+        {
+            perror(host_cfg.p_trace);
+            exit(1);
+        }
+        memcpy(header.magic, host_trace_magic, sizeof(header.magic));
+        fwrite(&header, sizeof(header), 1, p_file);
+    }
+
+    fwrite(&frame, sizeof(frame), 1, p_file);
+}
+
+void host_trace_record(unsigned adc1, unsigned adc2, unsigned adc1_cal, unsigned adc2_cal, unsigned loop_ms)
+{
+    struct host_trace_frame frame = {(uint16_t)adc1, (uint16_t)adc2};
+
+    host_trace_write(frame, adc1_cal, adc2_cal, loop_ms);
+}
+
+void host_trace_skip(unsigned adc1_cal, unsigned adc2_cal, unsigned loop_ms)
+{
+    struct host_trace_frame frame = {host_trace_skipped, host_trace_skipped};
+
+    host_trace_write(frame, adc1_cal, adc2_cal, loop_ms);
+}
+
+unsigned host_hw_btn(void)
+{
+	// buttons are held down for 200 mS from the time of their event
+    unsigned pressed = 0;
+    double t = host_hw_seconds();
+
+    for (int i = 0; i < host_cfg.num_events; i++)
+    {
+        const struct host_event* p_event = &host_cfg.events[i];
+
+        if (t < p_event->t || t >= p_event->t + 0.2)
+        {
+            continue;
+        }
+
+        switch (p_event->kind)
+        {
+            case 'U': pressed |= 0b1000; break;
+            case 'D': pressed |= 0b0100; break;
+            case 'L': pressed |= 0b0010; break;
+            case 'R': pressed |= 0b0001; break;
+            default: break;
+        }
+    }
+
+    return pressed;
+}
+
+unsigned host_hw_pmod_counter(void)
+{
+	// the knob holds the value of the latest K event
+    unsigned value = 0;
+
+    for (int i = 0; i < host_cfg.num_events; i++)
+    {
+        if (host_cfg.events[i].kind == 'K' && host_hw_seconds() >= host_cfg.events[i].t)
+        {
+            value = host_cfg.events[i].value;
+        }
+    }
+
+    return value;
+}
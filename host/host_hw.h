@@ -0,0 +1,143 @@
+// host model of the detector hardware, included by helloworld.c when it is built with HOST_SIM.
+// the register macros from the firmware are swapped for the models in host_hw.c, so the firmware
+// source runs unchanged on a Linux host against simulated coils, targets, buttons and displays.
+#ifndef HOST_HW_H
+#define HOST_HW_H
+
+#include <stdint.h>
+
+// registers the firmware only writes, the model reads them back when it needs to
+struct host_hw_regs
+{
+    unsigned port_a;
+    unsigned led;
+    unsigned ssd_hex;
+    unsigned ssd_raw_top;
+    unsigned ssd_raw_bot;
+    unsigned ssd_mode_dp;
+    unsigned sw;
+    unsigned excite_sel;
+};
+
+extern struct host_hw_regs host_hw;
+
+int host_hw_adc(int channel);
+unsigned* host_hw_timer_dur(void);
+unsigned host_hw_timer_state(void);
+unsigned host_hw_btn(void);
+unsigned host_hw_pmod_counter(void);
+
+#undef portA
+#undef LED
+#undef ADC1
+#undef ADC2
+#undef timer_dur
+#undef timer_state
+#undef pmod_counter
+#undef BTN
+#undef SW
+#undef SSD_HEX
+#undef SSD_RAW_TOP
+#undef SSD_RAW_BOT
+#undef SSD_MODE_DP
+#undef EXCITE_SEL
+
+#define portA host_hw.port_a
+#define LED host_hw.led
+#define ADC1 host_hw_adc(1)
+#define ADC2 host_hw_adc(2)
+// the firmware only ever writes timer_dur, so every use of it restarts the timer
+#define timer_dur (*host_hw_timer_dur())
+#define timer_state host_hw_timer_state()
+#define pmod_counter host_hw_pmod_counter()
+#define BTN host_hw_btn()
+#define SW host_hw.sw
+#define SSD_HEX host_hw.ssd_hex
+#define SSD_RAW_TOP host_hw.ssd_raw_top
+#define SSD_RAW_BOT host_hw.ssd_raw_bot
+#define SSD_MODE_DP host_hw.ssd_mode_dp
+#define EXCITE_SEL host_hw.excite_sel
+
+// the firmware's main(), renamed when built with HOST_SIM so host_sim.c can run it
+int firmware_main();
+
+// traces are a header followed by one host_trace_frame per main loop cycle, little endian. the
+// batch tool mdbatch reads them. a cycle low power mode skipped has both readings set to
+// host_trace_skipped, which no reading reaches, so the frames still count the time that passed.
+#define host_trace_magic "MDT1"
+#define host_trace_skipped 0xFFFF
+
+struct host_trace_header
+{
+    char magic[4];
+    uint16_t loop_ms;       // main loop period the frames were taken at
+    uint16_t adc1_cal;      // calibrated readings in mV
+    uint16_t adc2_cal;
+    uint16_t reserved;
+};
+
+struct host_trace_frame
+{
+    uint16_t adc1;          // readings in mV, as acquired before ground balance
+    uint16_t adc2;
+};
+
+// called by the firmware every main loop cycle that sampled the coils, records the frame when
+// the simulator was asked for a trace
+void host_trace_record(unsigned adc1, unsigned adc2, unsigned adc1_cal, unsigned adc2_cal, unsigned loop_ms);
+
+// called by the firmware every main loop cycle low power mode skipped, records a skipped frame
+void host_trace_skip(unsigned adc1_cal, unsigned adc2_cal, unsigned loop_ms);
+
+// everything the simulated world is made of, filled in from the command line by host_sim.c
+
+#define host_max_targets 8
+#define host_max_events 64
+#define host_max_freqs 8
+
+// a buried target. the drop it causes on a coil falls off with the cube of the distance,
+// and its eddy current response rises with excitation frequency up to size_mv.
+struct host_target
+{
+    double x_mm;            // position along the sweep
+    double depth_mm;        // depth below the coils
+    double size_mv;         // eddy current response at 50 mm at high frequency
+    double tau_us;          // eddy current time constant, larger for bigger and better conductors
+    double ferrous_mv;      // magnetic response at 50 mm at low frequency
+};
+
+// a button press, knob turn or switch change at a point in simulated time
+struct host_event
+{
+    double t;
+    char kind;              // U, D, L, R for buttons, K for the pmod knob, S for the switches, O for an open coil
+    unsigned value;
+};
+
+struct host_config
+{
+    double seconds;         // simulated run time
+    double appear_s;        // targets and ground are only there from this time, after calibration
+    double sweep_hz;        // the coils sweep sinusoidally over the ground at this rate
+    double sweep_mm;        // sweep amplitude either side of the centre
+    double coil_mm;         // each coil sits this far either side of the centre of the head
+    double baseline_mv;     // coil reading with nothing near it
+    double ground_mv;       // common mode drop from mineralised ground
+    double noise_mv;        // rms noise on every ADC reading
+    double hum_mv;          // mains hum amplitude
+    double hum_hz;
+    double freq_khz[host_max_freqs];    // excitation frequency selected by each EXCITE_SEL value
+    int num_freqs;
+    struct host_target targets[host_max_targets];
+    int num_targets;
+    struct host_event events[host_max_events];
+    int num_events;
+    int show_display;       // print every change of the SSD and LEDs to stderr
+    const char* p_trace;    // file to record a trace to, NULL for none
+};
+
+extern struct host_config host_cfg;
+
+double host_hw_seconds(void);
+
+#endif
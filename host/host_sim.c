@@ -0,0 +1,193 @@
+// host simulator for the metal detector firmware. helloworld.c is built unchanged against the
+// hardware model in host_hw.c and run over a simulated sweep of the coils.
+//
+// build from the repository root:
+//   cc -O2 -DHOST_SIM -Ihost helloworld.c host/host_hw.c host/host_sim.c -lm -o mdsim
+// a build with three excitation frequencies:
+//   cc -O2 -DHOST_SIM -DNUM_EXCITE_FREQS=3 -Ihost helloworld.c host/host_hw.c host/host_sim.c -lm -o mdsim
+//
+// telemetry the firmware prints goes to stdout, --display prints the SSD and LEDs to stderr.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host_hw.h"
+
+static void usage(const char* p_name)
+{
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  --seconds S            simulated run time (20)\n"
+        "  --appear S             time targets and ground appear, after calibration (10)\n"
+        "  --sweep HZ,MM          sweep rate and amplitude either side of centre (0.5,150)\n"
+        "  --target X,D,MV[,TAU[,FE]]\n"
+        "                         target at X mm along the sweep and D mm deep, MV eddy current\n"
+        "                         response at 50 mm, TAU eddy time constant in uS (50), FE\n"
+        "                         low frequency ferrous response at 50 mm (0)\n"
+        "  --freqs KHZ[,KHZ...]   excitation frequency for each EXCITE_SEL value (5,20,80)\n"
+        "  --ground MV            common mode drop from mineralised ground (0)\n"
+        "  --noise MV             rms noise on every reading (1)\n"
+        "  --hum MV[,HZ]          mains hum (0,50)\n"
+        "  --press T,B            hold button B (U, D, L or R) for 200 mS at time T\n"
+        "  --knob T,V             set the pmod knob to V at time T\n"
+        "  --sw T,V               set the switches to V at time T\n"
+        "  --open T,C             coil C (1 or 2) goes open circuit and reads 0 from time T\n"
+        "  --display              print SSD and LED changes to stderr\n"
+        "  --trace FILE           record every frame after calibration to FILE for mdbatch\n"
+        "events are applied in the order given, so give them in time order.\n",
+        p_name);
+    exit(2);
+}
+
+static void add_event(char kind, const char* p_arg)
+{
+    struct host_event* p_event = NULL;
+    char* p_end = NULL;
+
+    if (host_cfg.num_events >= host_max_events)
+    {
+        fprintf(stderr, "too many events\n");
+        exit(2);
+    }
+
+    p_event = &host_cfg.events[host_cfg.num_events++];
+    p_event->kind = kind;
+    p_event->t = strtod(p_arg, &p_end);
+    if (*p_end != ',')
+    {
+        fprintf(stderr, "bad event '%s'\n", p_arg);
+        exit(2);
+    }
+
+    if (kind == 'B')
+    {
+        p_event->kind = p_end[1];
+    }
+    else
+    {
+        p_event->value = strtoul(p_end + 1, NULL, 0);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    host_cfg.seconds = 20;
+    host_cfg.appear_s = 10;
+    host_cfg.sweep_hz = 0.5;
+    host_cfg.sweep_mm = 150;
+    host_cfg.coil_mm = 60;
+    host_cfg.baseline_mv = 800;
+    host_cfg.noise_mv = 1;
+    host_cfg.hum_hz = 50;
+    host_cfg.freq_khz[0] = 5;
+    host_cfg.freq_khz[1] = 20;
+    host_cfg.freq_khz[2] = 80;
+    host_cfg.num_freqs = 3;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char* p_opt = argv[i];
+        const char* p_arg = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if (!strcmp(p_opt, "--display"))
+        {
+            host_cfg.show_display = 1;
+            continue;
+        }
+
+        if (p_arg == NULL)
+        {
+            usage(argv[0]);
+        }
+        i++;
+
+        if (!strcmp(p_opt, "--seconds"))
+        {
+            host_cfg.seconds = atof(p_arg);
+        }
+        else if (!strcmp(p_opt, "--appear"))
+        {
+            host_cfg.appear_s = atof(p_arg);
+        }
+        else if (!strcmp(p_opt, "--sweep"))
+        {
+            sscanf(p_arg, "%lf,%lf", &host_cfg.sweep_hz, &host_cfg.sweep_mm);
+        }
+        else if (!strcmp(p_opt, "--target"))
+        {
+            struct host_target* p_target = &host_cfg.targets[host_cfg.num_targets];
+
+            if (host_cfg.num_targets >= host_max_targets)
+            {
+                fprintf(stderr, "too many targets\n");
+                return 2;
+            }
+            p_target->tau_us = 50;
+            p_target->ferrous_mv = 0;
+            if (sscanf(p_arg, "%lf,%lf,%lf,%lf,%lf", &p_target->x_mm, &p_target->depth_mm,
+                       &p_target->size_mv, &p_target->tau_us, &p_target->ferrous_mv) < 3)
+            {
+                usage(argv[0]);
+            }
+            host_cfg.num_targets++;
+        }
+        else if (!strcmp(p_opt, "--freqs"))
+        {
+            char* p_next = (char*)p_arg;
+
+            host_cfg.num_freqs = 0;
+            while (*p_next && host_cfg.num_freqs < host_max_freqs)
+            {
+                host_cfg.freq_khz[host_cfg.num_freqs++] = strtod(p_next, &p_next);
+                if (*p_next == ',')
+                {
+                    p_next++;
+                }
+            }
+        }
+        else if (!strcmp(p_opt, "--ground"))
+        {
+            host_cfg.ground_mv = atof(p_arg);
+        }
+        else if (!strcmp(p_opt, "--noise"))
+        {
+            host_cfg.noise_mv = atof(p_arg);
+        }
+        else if (!strcmp(p_opt, "--hum"))
+        {
+            sscanf(p_arg, "%lf,%lf", &host_cfg.hum_mv, &host_cfg.hum_hz);
+        }
+        else if (!strcmp(p_opt, "--press"))
+        {
+            add_event('B', p_arg);
+        }
+        else if (!strcmp(p_opt, "--knob"))
+        {
+            add_event('K', p_arg);
+        }
+        else if (!strcmp(p_opt, "--sw"))
+        {
+            add_event('S', p_arg);
+        }
+        else if (!strcmp(p_opt, "--trace"))
+        {
+            host_cfg.p_trace = p_arg;
+        }
+        else if (!strcmp(p_opt, "--open"))
+        {
+            add_event('O', p_arg);
+        }
+        else
+        {
+            usage(argv[0]);
+        }
+    }
+
+    if (host_cfg.num_freqs == 0)
+    {
+        usage(argv[0]);
+    }
+
+    // the firmware never returns, host_hw_timer_state() exits once the run time is up
+    return firmware_main();
+}
@@ -0,0 +1,144 @@
+// turns a detection log export into CSV. feed it the UART output of a log export from the menu
+// (LOG, SEnd), telemetry and other lines in between are skipped. every record comes out as one
+// row with the number of the parameter set that was in use when it was logged and its values.
+// the detector only keeps the last few sets, a record made with a set that has since been
+// overwritten gets empty parameter columns.
+//
+// build from the repository root:
+//   cc -O2 host/log2csv.c -o log2csv
+// and run as
+//   log2csv < uart_capture.txt > detections.csv
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// has to match log_max_param_sets in helloworld.c, set n is kept at n % max_param_sets
+#define max_param_sets 8
+
+// set numbers are 16 bit in the detector
+#define max_set_number 0xFFFF
+
+// fields of struct detector_params in helloworld.c, in order
+static const char* const param_names[] =
+{
+    "threshold_adc1", "threshold_adc2", "close_adc1", "close_adc2", "deadzone", "pos_alpha", "pos_beta",
+    "loop_ms", "gnd_mode", "gnd_offset_adc1", "gnd_offset_adc2", "gnd_track", "cfar",
+};
+
+#define num_params (sizeof(param_names) / sizeof(param_names[0]))
+
+static const char* const zone_names[] = {"far_left", "left", "centre", "right", "far_right"};
+
+// log_flag_* in helloworld.c
+#define flag_close 0b001
+#define flag_left 0b010
+#define flag_right 0b100
+
+int main(int argc, char** argv)
+{
+    static long param_sets[max_param_sets][num_params];
+    static long set_numbers[max_param_sets];
+    static int have_set[max_param_sets];
+    char line[512];
+    long rows = 0;
+    long overwritten = 0;
+    int ended = 0;
+
+    (void)argv;
+    if (argc > 1)
+    {
+        fprintf(stderr, "usage: log2csv < uart_capture.txt > detections.csv\n");
+        return 2;
+    }
+
+    printf("record,time_s,zone,peak_mv,duration_ms,close,left,right,param_set");
+    for (size_t i = 0; i < num_params; i++)
+    {
+        printf(",%s", param_names[i]);
+    }
+    printf("\n");
+
+    while (fgets(line, sizeof(line), stdin))
+    {
+        // the record may follow other output on the same line
+        char* p_rec = strchr(line, '$');
+
+        if (p_rec == NULL)
+        {
+            continue;
+        }
+
+        if (!strncmp(p_rec, "$LGH,", 5))
+        {
+            // a new export, parameter sets from an earlier one no longer apply
+            memset(have_set, 0, sizeof(have_set));
+            ended = 0;
+        }
+        else if (!strncmp(p_rec, "$LGP,", 5))
+        {
+            char* p_next = p_rec + 5;
+            long set = strtol(p_next, &p_next, 10);
+
+            if (set < 0 || set > max_set_number)
+            {
+                fprintf(stderr, "bad parameter set: %s", p_rec);
+                continue;
+            }
+
+            for (size_t i = 0; i < num_params; i++)
+            {
+                param_sets[set % max_param_sets][i] = (*p_next == ',') ? strtol(p_next + 1, &p_next, 10) : 0;
+            }
+            set_numbers[set % max_param_sets] = set;
+            have_set[set % max_param_sets] = 1;
+        }
+        else if (!strncmp(p_rec, "$LOG,", 5))
+        {
+            long record, time_ms, zone, peak, duration, set, flags;
+            int held = 0;
+
+            if (sscanf(p_rec, "$LOG,%ld,%ld,%ld,%ld,%ld,%ld,%ld", &record, &time_ms, &zone, &peak,
+                       &duration, &set, &flags) != 7 || zone < 0 || zone > 4 || set < 0 || set > max_set_number)
+            {
+                fprintf(stderr, "bad record: %s", p_rec);
+                continue;
+            }
+
+            // the slot may hold a later set that took its place
+            held = have_set[set % max_param_sets] && set_numbers[set % max_param_sets] == set;
+            overwritten += !held;
+
+            printf("%ld,%.3f,%s,%ld,%ld,%d,%d,%d,%ld", record, time_ms / 1000.0, zone_names[zone], peak, duration,
+                   (flags & flag_close) != 0, (flags & flag_left) != 0, (flags & flag_right) != 0, set);
+            for (size_t i = 0; i < num_params; i++)
+            {
+                if (held)
+                {
+                    printf(",%ld", param_sets[set % max_param_sets][i]);
+                }
+                else
+                {
+                    printf(",");
+                }
+            }
+            printf("\n");
+            rows++;
+        }
+        else if (!strncmp(p_rec, "$LGE", 4))
+        {
+            ended = 1;
+        }
+    }
+
+    if (rows && !ended)
+    {
+        fprintf(stderr, "warning: the export did not finish, the capture may be cut short\n");
+    }
+    if (overwritten)
+    {
+        fprintf(stderr, "%ld records were made with parameter sets the detector no longer held, "
+                "their parameters are left empty\n", overwritten);
+    }
+
+    return 0;
+}
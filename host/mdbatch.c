@@ -0,0 +1,453 @@
+// batch run of the firmware detection core over recorded traces. every trace is split into chunks
+// that run in parallel on all cores, each through the same detector_update(), log_update() and
+// zone_count_update() the firmware runs every main loop cycle. it prints the detections (the
+// records the firmware would have logged) and a summary of each trace.
+//
+// build from the repository root:
+//   cc -O2 -DHOST_SIM -Ihost host/mdbatch.c host/host_hw.c -lm -lpthread -o mdbatch
+// record traces with the simulator and run over them:
+//   mdsim --seconds 3600 --target 0,40,80 --trace sweep.mdt
+//   mdbatch --events events.csv sweep.mdt more/*.mdt
+//
+// a chunk starts warmup samples early and throws away what it sees there. the CFAR windows only
+// remember the last cfar_cells samples, and the coil states, log and zone counter forget
+// everything once nothing is detected, so by the start of the chunk the state matches a run over
+// the whole trace unless a detection lasts longer than the warm-up. a detection belongs to the
+// chunk it ends in.
+//
+// ground balance, the self-test single coil fallback and menu changes to the settings are not
+// replayed, traces are run with one set of settings from start to end. cycles low power mode
+// skipped run nothing, as in the firmware, but still count for the time of the frames after them.
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// the firmware is built into this tool whole, so the detection core is the firmware's own code
+#include "../helloworld.c"
+#undef main
+
+// samples per chunk, and samples each chunk runs before its start to settle
+#define batch_chunk_samples (1 << 22)
+#define batch_warmup_samples (1 << 14)
+
+// a memory mapped trace
+struct trace
+{
+    const char* p_name;
+    const struct host_trace_header* p_header;
+    const struct host_trace_frame* p_frames;
+    size_t num_frames;
+    size_t map_size;
+};
+
+// a detection and the sample it ended on
+struct batch_event
+{
+    size_t end;
+    struct log_record record;
+};
+
+// a part of a trace and what was found in it
+struct chunk
+{
+    const struct trace* p_trace;
+    size_t first;               // first sample the chunk owns
+    size_t end;
+    struct batch_event* p_events;
+    size_t num_events;
+    size_t cap_events;
+    uint64_t zone_counts[zone_none];    // objects counted the way the num_objects mode counts them
+    uint64_t sampled_samples;           // samples the coils were read in, not skipped by low power
+    uint64_t detected_samples;          // samples either coil saw metal on
+};
+
+// shared by the worker threads
+struct batch
+{
+    struct chunk* p_chunks;
+    size_t num_chunks;
+    size_t next_chunk;
+    pthread_mutex_t lock;
+    struct detector_params params;
+    size_t warmup;
+};
+
+static int open_trace(struct trace* p_trace, const char* p_name)
+{
+	// maps a trace into memory, 0 when it is a good trace
+    struct stat st;
+    int fd = open(p_name, O_RDONLY);
+    void* p_map = NULL;
+
+    memset(p_trace, 0, sizeof(*p_trace));
+    p_trace->p_name = p_name;
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        perror(p_name);
+        return -1;
+    }
+    if ((size_t)st.st_size < sizeof(struct host_trace_header))
+    {
+        fprintf(stderr, "%s: too short to be a trace\n", p_name);
+        close(fd);
+        return -1;
+    }
+
+    p_map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p_map == MAP_FAILED)
+    {
+        perror(p_name);
+        return -1;
+    }
+    madvise(p_map, st.st_size, MADV_SEQUENTIAL);
+
+    p_trace->map_size = st.st_size;
+    p_trace->p_header = p_map;
+    p_trace->p_frames = (const struct host_trace_frame*)(p_trace->p_header + 1);
+    p_trace->num_frames = (st.st_size - sizeof(struct host_trace_header)) / sizeof(struct host_trace_frame);
+
+    if (memcmp(p_trace->p_header->magic, host_trace_magic, sizeof(p_trace->p_header->magic))
+        || p_trace->p_header->loop_ms == 0)
+    {
+        fprintf(stderr, "%s: not an %s trace\n", p_name, host_trace_magic);
+        munmap(p_map, st.st_size);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void add_event(struct chunk* p_chunk, size_t end, const struct log_record* p_record)
+{
+    if (p_chunk->num_events == p_chunk->cap_events)
+    {
+        p_chunk->cap_events = p_chunk->cap_events ? 2 * p_chunk->cap_events : 256;
+        p_chunk->p_events = realloc(p_chunk->p_events, p_chunk->cap_events * sizeof(struct batch_event));
+        if (p_chunk->p_events == NULL)
+        {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+
+    p_chunk->p_events[p_chunk->num_events].end = end;
+    p_chunk->p_events[p_chunk->num_events].record = *p_record;
+    p_chunk->num_events++;
+}
+
+static void run_chunk(struct chunk* p_chunk, const struct detector_params* p_defaults, size_t warmup)
+{
+	// runs the detection core over a chunk, from warmup samples before it
+    const struct trace* p_trace = p_chunk->p_trace;
+    const struct host_trace_header* p_header = p_trace->p_header;
+    struct detector det;
+    struct detection_log log;
+    struct zone_counter counter = {{0}, zone_none, 0};
+    struct detector_params params = *p_defaults;
+    struct adc_frame frame;
+    uint32_t logged = 0;
+    uint8_t counted[zone_none] = {0};
+    uint64_t sampled = 0;
+    uint64_t detected = 0;
+    size_t i = (p_chunk->first > warmup) ? p_chunk->first - warmup : 0;
+
+    memset(&det, 0, sizeof(det));
+    memset(&log, 0, sizeof(log));
+    params.loop_ms = p_header->loop_ms;
+
+    for (; i < p_chunk->end; i++)
+    {
+        frame.adc1 = p_trace->p_frames[i].adc1;
+        frame.adc2 = p_trace->p_frames[i].adc2;
+
+        // the firmware only waited for the tick in a skipped cycle
+        if (frame.adc1 == host_trace_skipped && frame.adc2 == host_trace_skipped)
+        {
+            continue;
+        }
+
+        // the same calls in the same order as the main loop
+        detector_update(&det, &params, &frame, p_header->adc1_cal, p_header->adc2_cal);
+        log_update(&log, det.left.detected, det.right.detected, det.is_close, det.strength_total / 256, &params,
+                   (uint32_t)((i + 1) * params.loop_ms));
+        zone_count_update(&counter, det.left.detected, det.right.detected, det.is_close, params.loop_ms);
+
+        // a record was appended, the log itself only holds the last log_max_records
+        if (log.count != logged)
+        {
+            logged = log.count;
+            if (i >= p_chunk->first)
+            {
+                add_event(p_chunk, i, log_record_at(&log, log.count - 1));
+            }
+        }
+
+        // the counter has just counted an object in the zone it last counted in. its own
+        // counts are only 8 bits, so they are followed here rather than read at the end.
+        if (counter.previous != zone_none && counter.counts[counter.previous] != counted[counter.previous])
+        {
+            counted[counter.previous] = counter.counts[counter.previous];
+            if (i >= p_chunk->first)
+            {
+                p_chunk->zone_counts[counter.previous]++;
+            }
+        }
+
+        sampled += i >= p_chunk->first;
+        detected += (i >= p_chunk->first) && (det.left.detected || det.right.detected);
+    }
+
+    // chunks sit next to each other in memory, so the totals are only written back at the end
+    // rather than shared between threads every sample
+    p_chunk->sampled_samples = sampled;
+    p_chunk->detected_samples = detected;
+}
+
+static void* worker(void* p_arg)
+{
+	// takes chunks until there are none left
+    struct batch* p_batch = p_arg;
+
+    while (1)
+    {
+        size_t index = 0;
+
+        pthread_mutex_lock(&p_batch->lock);
+        index = p_batch->next_chunk++;
+        pthread_mutex_unlock(&p_batch->lock);
+
+        if (index >= p_batch->num_chunks)
+        {
+            return NULL;
+        }
+        run_chunk(&p_batch->p_chunks[index], &p_batch->params, p_batch->warmup);
+    }
+}
+
+static void parse_pair(const char* p_arg, uint16_t* p_a, uint16_t* p_b)
+{
+	// N or N,M for a setting of both coils
+    unsigned a = 0;
+    unsigned b = 0;
+    int got = sscanf(p_arg, "%u,%u", &a, &b);
+
+    *p_a = a;
+    *p_b = (got == 2) ? b : a;
+}
+
+static void usage(const char* p_name)
+{
+    fprintf(stderr,
+        "usage: %s [options] trace...\n"
+        "  --events FILE          write every detection to FILE as CSV, - for standard output\n"
+        "  --jobs N               worker threads, one per core by default\n"
+        "  --chunk N              samples per chunk (%d)\n"
+        "  --warmup N             samples each chunk runs before its start (%d)\n"
+        "  --cfar                 thresholds that follow the noise, as CFAr on in the menu\n"
+        "  --threshold MV[,MV]    detect thresholds of ADC1 and ADC2\n"
+        "  --close MV[,MV]        close thresholds\n"
+        "  --deadzone MV          hysteresis around every threshold\n"
+        "settings not given are the firmware defaults, the loop period comes from each trace.\n",
+        p_name, batch_chunk_samples, batch_warmup_samples);
+    exit(2);
+}
+
+int main(int argc, char** argv)
+{
+    static const char* const zone_names[] = {"far_left", "left", "centre", "right", "far_right"};
+    struct batch batch;
+    struct trace* p_traces = calloc(argc, sizeof(struct trace));
+    size_t num_traces = 0;
+    size_t chunk_samples = batch_chunk_samples;
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    const char* p_events_name = NULL;
+    FILE* p_events = NULL;
+    pthread_t* p_threads = NULL;
+    struct timespec start;
+    struct timespec stop;
+    uint64_t total_samples = 0;
+    size_t c = 0;
+    double seconds = 0;
+
+    memset(&batch, 0, sizeof(batch));
+    batch.params = default_params;
+    batch.warmup = batch_warmup_samples;
+    pthread_mutex_init(&batch.lock, NULL);
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char* p_opt = argv[i];
+        const char* p_arg = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if (p_opt[0] != '-' || !strcmp(p_opt, "-"))
+        {
+            if (open_trace(&p_traces[num_traces], p_opt) == 0)
+            {
+                num_traces++;
+            }
+            continue;
+        }
+        if (!strcmp(p_opt, "--cfar"))
+        {
+            batch.params.cfar = 1;
+            continue;
+        }
+        if (p_arg == NULL)
+        {
+            usage(argv[0]);
+        }
+        i++;
+
+        if (!strcmp(p_opt, "--events"))
+        {
+            p_events_name = p_arg;
+        }
+        else if (!strcmp(p_opt, "--jobs"))
+        {
+            jobs = atol(p_arg);
+        }
+        else if (!strcmp(p_opt, "--chunk"))
+        {
+            chunk_samples = strtoul(p_arg, NULL, 0);
+        }
+        else if (!strcmp(p_opt, "--warmup"))
+        {
+            batch.warmup = strtoul(p_arg, NULL, 0);
+        }
+        else if (!strcmp(p_opt, "--threshold"))
+        {
+            parse_pair(p_arg, &batch.params.threshold_adc1, &batch.params.threshold_adc2);
+        }
+        else if (!strcmp(p_opt, "--close"))
+        {
+            parse_pair(p_arg, &batch.params.close_adc1, &batch.params.close_adc2);
+        }
+        else if (!strcmp(p_opt, "--deadzone"))
+        {
+            batch.params.deadzone = atoi(p_arg);
+        }
+        else
+        {
+            usage(argv[0]);
+        }
+    }
+    if (num_traces == 0 || jobs < 1 || chunk_samples < 1)
+    {
+        usage(argv[0]);
+    }
+
+    // every trace is cut into chunks, and the chunks of all traces are shared out together
+    for (size_t t = 0; t < num_traces; t++)
+    {
+        batch.num_chunks += (p_traces[t].num_frames + chunk_samples - 1) / chunk_samples;
+    }
+    batch.p_chunks = calloc(batch.num_chunks, sizeof(struct chunk));
+    for (size_t t = 0; t < num_traces; t++)
+    {
+        for (size_t first = 0; first < p_traces[t].num_frames; first += chunk_samples)
+        {
+            batch.p_chunks[c].p_trace = &p_traces[t];
+            batch.p_chunks[c].first = first;
+            batch.p_chunks[c].end = (first + chunk_samples < p_traces[t].num_frames)
+                                    ? first + chunk_samples : p_traces[t].num_frames;
+            c++;
+        }
+        total_samples += p_traces[t].num_frames;
+    }
+
+    jobs = ((size_t)jobs > batch.num_chunks && batch.num_chunks) ? (long)batch.num_chunks : jobs;
+    p_threads = calloc(jobs, sizeof(pthread_t));
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long j = 0; j < jobs; j++)
+    {
+        pthread_create(&p_threads[j], NULL, worker, &batch);
+    }
+    for (long j = 0; j < jobs; j++)
+    {
+        pthread_join(p_threads[j], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    seconds = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+
+    if (p_events_name != NULL)
+    {
+        p_events = strcmp(p_events_name, "-") ? fopen(p_events_name, "w") : stdout;
+        if (p_events == NULL)
+        {
+            perror(p_events_name);
+            return 1;
+        }
+        fprintf(p_events, "trace,time_s,zone,peak_mv,duration_ms,close,left,right\n");
+    }
+
+    printf("%-24s %10s %8s %7s %8s %6s %6s %6s %9s %6s %7s %7s\n", "trace", "samples", "hours", "events",
+           "far_left", "left", "centre", "right", "far_right", "close", "detect%", "peak_mv");
+
+    // chunks are in trace order, and the events of each chunk in the order they ended
+    c = 0;
+    for (size_t t = 0; t < num_traces; t++)
+    {
+        const struct trace* p_trace = &p_traces[t];
+        uint64_t counts[zone_none] = {0};
+        uint64_t events = 0;
+        uint64_t close_events = 0;
+        uint64_t sampled = 0;
+        uint64_t detected = 0;
+        unsigned peak = 0;
+
+        for (; c < batch.num_chunks && batch.p_chunks[c].p_trace == p_trace; c++)
+        {
+            const struct chunk* p_chunk = &batch.p_chunks[c];
+
+            for (int z = 0; z < zone_none; z++)
+            {
+                counts[z] += p_chunk->zone_counts[z];
+            }
+            sampled += p_chunk->sampled_samples;
+            detected += p_chunk->detected_samples;
+
+            for (size_t e = 0; e < p_chunk->num_events; e++)
+            {
+                const struct log_record* p_rec = &p_chunk->p_events[e].record;
+
+                events++;
+                close_events += (p_rec->flags & log_flag_close) != 0;
+                peak = (p_rec->peak > peak) ? p_rec->peak : peak;
+                if (p_events != NULL)
+                {
+                    fprintf(p_events, "%s,%.3f,%s,%u,%u,%d,%d,%d\n", p_trace->p_name, p_rec->time_ms / 1000.0,
+                            zone_names[p_rec->zone < zone_none ? p_rec->zone : 0], p_rec->peak, p_rec->duration_ms,
+                            (p_rec->flags & log_flag_close) != 0, (p_rec->flags & log_flag_left) != 0,
+                            (p_rec->flags & log_flag_right) != 0);
+                }
+            }
+        }
+
+        // samples are the cycles the coils were read in, hours count the skipped ones too
+        printf("%-24s %10llu %8.2f %7llu %8llu %6llu %6llu %6llu %9llu %6llu %7.2f %7u\n", p_trace->p_name,
+               (unsigned long long)sampled, p_trace->num_frames * p_trace->p_header->loop_ms / 3.6e6,
+               (unsigned long long)events, (unsigned long long)counts[zone_far_left],
+               (unsigned long long)counts[zone_left], (unsigned long long)counts[zone_centre],
+               (unsigned long long)counts[zone_right], (unsigned long long)counts[zone_far_right],
+               (unsigned long long)close_events, sampled ? 100.0 * detected / sampled : 0.0,
+               peak);
+    }
+
+    if (p_events != NULL && p_events != stdout)
+    {
+        fclose(p_events);
+    }
+
+    fprintf(stderr, "%zu traces, %llu samples in %.3f s on %ld threads, %.1f M samples/s\n", num_traces,
+            (unsigned long long)total_samples, seconds, jobs, seconds > 0 ? total_samples / seconds / 1e6 : 0.0);
+
+    return 0;
+}
@@ -0,0 +1,850 @@
+// terminal visualizer for the sample stream the firmware sends while SW[2] is on. it draws the
+// signal of each coil against its detect and close thresholds and their deadzone bands, with the
+// detection state underneath, and scrolls along with a live stream or over a whole capture.
+//
+// build from the repository root:
+//   cc -O2 host/mdviz.c -o mdviz
+// and run on the simulator, a UART capture, or a capture that is still being written:
+//   mdsim --sw 0,4 --seconds 600 | mdviz
+//   mdviz uart_capture.txt
+//   mdviz --dump --cols 160 --rows 40 uart_capture.txt > screen.txt
+//
+// keys: left and right (or h and l) scroll, up and down (or + and -) zoom, g and G jump to the
+// start and end, f follows new samples, a switches between auto and fixed vertical scale, q quits.
+//
+// every sample is kept, along with a pyramid of min/max summaries of 4, 16, 64... samples. a
+// screen column over any number of samples is drawn from a handful of summaries, so zooming out
+// over hours of capture costs no more than drawing a few seconds of it.
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+// each pyramid level summarises this many entries of the level below
+#define viz_fanout 4
+#define viz_max_levels 16
+
+// state bits of a $SMP record, per coil
+#define state_detected 0b01
+#define state_close 0b10
+
+// the firmware's signals and thresholds are Q8 mV
+#define q8_one 256
+
+struct sample
+{
+    uint32_t time_ms;
+    int32_t signal[2];
+    uint8_t state;          // bits 0 and 1 for ADC1 detected and close, bits 2 and 3 for ADC2
+};
+
+// thresholds of both coils as sent in a $THR record, in force from sample index on
+struct levels_change
+{
+    size_t index;
+    int32_t detect[2];
+    int32_t close[2];
+    int32_t half_deadzone[2];
+};
+
+// min and max of each coil's signal over a run of samples, and every state seen during it
+struct summary
+{
+    int32_t min[2];
+    int32_t max[2];
+    uint8_t state;
+};
+
+struct viz
+{
+    struct sample* p_samples;
+    size_t num_samples;
+    size_t cap_samples;
+
+    // level k holds summaries of viz_fanout^(k + 1) samples
+    struct summary* p_level[viz_max_levels];
+    size_t level_count[viz_max_levels];
+    size_t level_cap[viz_max_levels];
+
+    struct levels_change* p_changes;
+    size_t num_changes;
+    size_t cap_changes;
+};
+
+// what part of the capture is on screen and how
+struct view
+{
+    size_t start;           // first sample drawn
+    size_t zoom;            // samples per screen column
+    int follow;             // keep the newest sample at the right edge
+    int fixed_scale;
+    int32_t scale_lo;       // fixed vertical scale in Q8
+    int32_t scale_hi;
+    int cols;
+    int rows;
+    int colour;
+};
+
+static void* grow(void* p_array, size_t* p_cap, size_t needed, size_t item_size)
+{
+	// doubles an array until it holds needed items
+    size_t cap = *p_cap ? *p_cap : 1024;
+
+    if (needed <= *p_cap)
+    {
+        return p_array;
+    }
+    while (cap < needed)
+    {
+        cap *= 2;
+    }
+
+    p_array = realloc(p_array, cap * item_size);
+    if (p_array == NULL)
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    *p_cap = cap;
+
+    return p_array;
+}
+
+static void summary_empty(struct summary* p_sum)
+{
+    for (int c = 0; c < 2; c++)
+    {
+        p_sum->min[c] = INT32_MAX;
+        p_sum->max[c] = INT32_MIN;
+    }
+    p_sum->state = 0;
+}
+
+static void summary_merge(struct summary* p_sum, const struct summary* p_other)
+{
+    for (int c = 0; c < 2; c++)
+    {
+        p_sum->min[c] = (p_other->min[c] < p_sum->min[c]) ? p_other->min[c] : p_sum->min[c];
+        p_sum->max[c] = (p_other->max[c] > p_sum->max[c]) ? p_other->max[c] : p_sum->max[c];
+    }
+    p_sum->state |= p_other->state;
+}
+
+static void summary_of_sample(struct summary* p_sum, const struct sample* p_sample)
+{
+    for (int c = 0; c < 2; c++)
+    {
+        p_sum->min[c] = p_sample->signal[c];
+        p_sum->max[c] = p_sample->signal[c];
+    }
+    p_sum->state = p_sample->state;
+}
+
+static void push_summary(struct viz* p_viz, int level, const struct summary* p_sum)
+{
+	// adds a summary to a level, and once the level has another viz_fanout of them, their
+	// summary to the level above
+    struct summary parent;
+
+    p_viz->p_level[level] = grow(p_viz->p_level[level], &p_viz->level_cap[level], p_viz->level_count[level] + 1,
+                                 sizeof(struct summary));
+    p_viz->p_level[level][p_viz->level_count[level]++] = *p_sum;
+
+    if (p_viz->level_count[level] % viz_fanout || level + 1 == viz_max_levels)
+    {
+        return;
+    }
+
+    summary_empty(&parent);
+    for (size_t i = p_viz->level_count[level] - viz_fanout; i < p_viz->level_count[level]; i++)
+    {
+        summary_merge(&parent, &p_viz->p_level[level][i]);
+    }
+    push_summary(p_viz, level + 1, &parent);
+}
+
+static void add_sample(struct viz* p_viz, const struct sample* p_sample)
+{
+    struct summary sum;
+    struct summary item;
+
+    p_viz->p_samples = grow(p_viz->p_samples, &p_viz->cap_samples, p_viz->num_samples + 1, sizeof(struct sample));
+    p_viz->p_samples[p_viz->num_samples++] = *p_sample;
+
+    if (p_viz->num_samples % viz_fanout)
+    {
+        return;
+    }
+
+    summary_empty(&sum);
+    for (size_t i = p_viz->num_samples - viz_fanout; i < p_viz->num_samples; i++)
+    {
+        summary_of_sample(&item, &p_viz->p_samples[i]);
+        summary_merge(&sum, &item);
+    }
+    push_summary(p_viz, 0, &sum);
+}
+
+static void range_summary(const struct viz* p_viz, size_t first, size_t end, struct summary* p_sum)
+{
+	// min and max over samples first to end - 1, from the largest summaries that fit inside it
+    struct summary item;
+
+    summary_empty(p_sum);
+    while (first < end)
+    {
+        size_t size = 1;
+        int level = -1;
+
+        for (int k = 0; k < viz_max_levels; k++)
+        {
+            size_t next = size * viz_fanout;
+
+            if (first % next || first + next > end || first / next >= p_viz->level_count[k])
+            {
+                break;
+            }
+            size = next;
+            level = k;
+        }
+
+        if (level < 0)
+        {
+            summary_of_sample(&item, &p_viz->p_samples[first]);
+            summary_merge(p_sum, &item);
+        }
+        else
+        {
+            summary_merge(p_sum, &p_viz->p_level[level][first / size]);
+        }
+        first += size;
+    }
+}
+
+static const struct levels_change* levels_at(const struct viz* p_viz, size_t index)
+{
+	// thresholds in force at a sample, NULL before the first $THR
+    size_t lo = 0;
+    size_t hi = p_viz->num_changes;
+
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+
+        if (p_viz->p_changes[mid].index <= index)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return lo ? &p_viz->p_changes[lo - 1] : NULL;
+}
+
+static void parse_line(struct viz* p_viz, const char* p_line)
+{
+	// $SMP,<time mS>,<signal 1>,<signal 2>,<state>
+	// $THR,<time mS>,<detect 1>,<close 1>,<half deadzone 1>,<detect 2>,<close 2>,<half deadzone 2>
+	// anything else, such as other telemetry, is skipped
+    const char* p_rec = strchr(p_line, '$');
+    long f[7];
+
+    if (p_rec == NULL)
+    {
+        return;
+    }
+
+    if (!strncmp(p_rec, "$SMP,", 5) && sscanf(p_rec, "$SMP,%ld,%ld,%ld,%ld", &f[0], &f[1], &f[2], &f[3]) == 4)
+    {
+        struct sample sample = {(uint32_t)f[0], {(int32_t)f[1], (int32_t)f[2]}, (uint8_t)f[3]};
+
+        add_sample(p_viz, &sample);
+    }
+    else if (!strncmp(p_rec, "$THR,", 5)
+             && sscanf(p_rec, "$THR,%ld,%ld,%ld,%ld,%ld,%ld,%ld", &f[0], &f[1], &f[2], &f[3], &f[4], &f[5], &f[6]) == 7)
+    {
+        struct levels_change* p_change = NULL;
+
+        // a change before any sample, or several between two samples, replaces the last one
+        if (p_viz->num_changes && p_viz->p_changes[p_viz->num_changes - 1].index == p_viz->num_samples)
+        {
+            p_change = &p_viz->p_changes[p_viz->num_changes - 1];
+        }
+        else
+        {
+            p_viz->p_changes = grow(p_viz->p_changes, &p_viz->cap_changes, p_viz->num_changes + 1,
+                                    sizeof(struct levels_change));
+            p_change = &p_viz->p_changes[p_viz->num_changes++];
+        }
+
+        p_change->index = p_viz->num_samples;
+        for (int c = 0; c < 2; c++)
+        {
+            p_change->detect[c] = f[1 + 3 * c];
+            p_change->close[c] = f[2 + 3 * c];
+            p_change->half_deadzone[c] = f[3 + 3 * c];
+        }
+    }
+}
+
+// input is read in blocks and split into lines here, so a pipe can be read without blocking
+struct line_reader
+{
+    int fd;
+    int done;
+    char buf[4096];
+    size_t used;
+};
+
+static int read_input(struct viz* p_viz, struct line_reader* p_in)
+{
+	// reads what input there is, returns 1 if any samples or thresholds came in
+    size_t before = p_viz->num_samples + p_viz->num_changes;
+
+    while (!p_in->done)
+    {
+        ssize_t got = read(p_in->fd, p_in->buf + p_in->used, sizeof(p_in->buf) - 1 - p_in->used);
+        char* p_line = p_in->buf;
+        char* p_end = NULL;
+
+        if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        {
+            break;
+        }
+        if (got <= 0)
+        {
+            p_in->done = 1;
+            break;
+        }
+
+        p_in->used += got;
+        p_in->buf[p_in->used] = '\0';
+        while ((p_end = strchr(p_line, '\n')) != NULL)
+        {
+            *p_end = '\0';
+            parse_line(p_viz, p_line);
+            p_line = p_end + 1;
+        }
+
+        // keep the part line for the next read, a line too long for the buffer is dropped
+        p_in->used = p_in->buf + p_in->used - p_line;
+        if (p_in->used == sizeof(p_in->buf) - 1)
+        {
+            p_in->used = 0;
+        }
+        memmove(p_in->buf, p_line, p_in->used);
+    }
+
+    return p_viz->num_samples + p_viz->num_changes != before;
+}
+
+// a screen is built up in one buffer and written out in one go
+struct screen
+{
+    char* p_text;
+    size_t len;
+    size_t cap;
+};
+
+static void put(struct screen* p_scr, const char* p_text)
+{
+    size_t len = strlen(p_text);
+
+    p_scr->p_text = grow(p_scr->p_text, &p_scr->cap, p_scr->len + len + 1, 1);
+    memcpy(p_scr->p_text + p_scr->len, p_text, len + 1);
+    p_scr->len += len;
+}
+
+static int scale_row(int32_t value, int32_t lo, int32_t hi, int rows)
+{
+	// row a value falls on, 0 at the top for hi
+    int64_t row = (int64_t)(hi - value) * (rows - 1) / (hi - lo);
+
+    return (row < 0) ? 0 : ((row >= rows) ? rows - 1 : (int)row);
+}
+
+static void draw_panel(struct screen* p_scr, const struct viz* p_viz, const struct view* p_view, int channel,
+                       int rows, int32_t lo, int32_t hi)
+{
+	// one coil: the signal of each column from its min to its max, over the detect (-) and
+	// close (=) thresholds, their deadzone bands (:) and 0 mV (.), with the detection state below
+    static const char* const colour_of[] = {"\x1b[32m", "\x1b[33m", "\x1b[31m"};
+    int cols = p_view->cols;
+    char* p_grid = malloc((size_t)rows * cols + 1);
+    uint8_t* p_state = calloc(cols, 1);
+    int zero = scale_row(0, lo, hi, rows);
+    char label[64];
+
+    memset(p_grid, ' ', (size_t)rows * cols);
+
+    for (int x = 0; x < cols; x++)
+    {
+        size_t first = p_view->start + (size_t)x * p_view->zoom;
+        size_t end = first + p_view->zoom;
+        const struct levels_change* p_levels = NULL;
+        struct summary sum;
+
+        if (first >= p_viz->num_samples)
+        {
+            break;
+        }
+        end = (end > p_viz->num_samples) ? p_viz->num_samples : end;
+
+        if (zero >= 0 && 0 >= lo && 0 <= hi)
+        {
+            p_grid[zero * cols + x] = '.';
+        }
+
+        p_levels = levels_at(p_viz, first);
+        if (p_levels != NULL)
+        {
+            int32_t level[2] = {p_levels->detect[channel], p_levels->close[channel]};
+
+            for (int i = 0; i < 2; i++)
+            {
+                int top = scale_row(level[i] + p_levels->half_deadzone[channel], lo, hi, rows);
+                int bottom = scale_row(level[i] - p_levels->half_deadzone[channel], lo, hi, rows);
+
+                for (int y = top; y <= bottom; y++)
+                {
+                    p_grid[y * cols + x] = ':';
+                }
+                p_grid[scale_row(level[i], lo, hi, rows) * cols + x] = i ? '=' : '-';
+            }
+        }
+
+        range_summary(p_viz, first, end, &sum);
+        for (int y = scale_row(sum.max[channel], lo, hi, rows); y <= scale_row(sum.min[channel], lo, hi, rows); y++)
+        {
+            p_grid[y * cols + x] = '#';
+        }
+        p_state[x] = (sum.state >> (2 * channel)) & (state_detected | state_close);
+    }
+
+    for (int y = 0; y < rows; y++)
+    {
+        for (int x = 0; x < cols; x++)
+        {
+            char cell[16] = {p_grid[y * cols + x], '\0'};
+            int level = (p_state[x] & state_close) ? 2 : ((p_state[x] & state_detected) ? 1 : 0);
+
+            // the signal is coloured by the detection state of its column
+            if (p_view->colour && cell[0] == '#')
+            {
+                snprintf(cell, sizeof(cell), "%s#\x1b[0m", colour_of[level]);
+            }
+            put(p_scr, cell);
+        }
+        put(p_scr, "\n");
+    }
+
+    // state line, f where the coil saw metal far and C where it was close, with the coil's
+    // name at the right hand end
+    for (int x = 0; x < cols; x++)
+    {
+        p_grid[x] = (p_state[x] & state_close) ? 'C' : ((p_state[x] & state_detected) ? 'f' : ' ');
+    }
+    snprintf(label, sizeof(label), " ADC%d", channel + 1);
+    memcpy(p_grid + cols - strlen(label), label, strlen(label));
+    p_grid[cols] = '\0';
+    put(p_scr, p_grid);
+    put(p_scr, "\n");
+
+    free(p_grid);
+    free(p_state);
+}
+
+static void visible_scale(const struct viz* p_viz, const struct view* p_view, int32_t* p_lo, int32_t* p_hi)
+{
+	// vertical scale that fits both signals, 0 and the thresholds on screen, shared by both panels
+    size_t end = p_view->start + (size_t)p_view->cols * p_view->zoom;
+    struct summary sum;
+    int32_t lo = 0;
+    int32_t hi = 0;
+
+    if (p_view->fixed_scale)
+    {
+        *p_lo = p_view->scale_lo;
+        *p_hi = p_view->scale_hi;
+        return;
+    }
+
+    end = (end > p_viz->num_samples) ? p_viz->num_samples : end;
+    if (p_view->start < end)
+    {
+        range_summary(p_viz, p_view->start, end, &sum);
+        for (int c = 0; c < 2; c++)
+        {
+            lo = (sum.min[c] < lo) ? sum.min[c] : lo;
+            hi = (sum.max[c] > hi) ? sum.max[c] : hi;
+        }
+    }
+
+    for (size_t i = 0; i < p_viz->num_changes; i++)
+    {
+        const struct levels_change* p_change = &p_viz->p_changes[i];
+
+        // only changes in force somewhere on screen
+        if (p_change->index >= end && i > 0)
+        {
+            break;
+        }
+        if (i + 1 < p_viz->num_changes && p_viz->p_changes[i + 1].index <= p_view->start)
+        {
+            continue;
+        }
+        for (int c = 0; c < 2; c++)
+        {
+            int32_t top = p_change->close[c] + p_change->half_deadzone[c];
+
+            hi = (top > hi) ? top : hi;
+        }
+    }
+
+    // a little headroom, and never less than a mV either way
+    *p_lo = lo - (hi - lo) / 16 - q8_one;
+    *p_hi = hi + (hi - lo) / 16 + q8_one;
+}
+
+static void clamp_view(const struct viz* p_viz, struct view* p_view)
+{
+	// keeps the view inside the capture, following the newest sample when asked to
+    size_t span = (size_t)p_view->cols * p_view->zoom;
+
+    if (p_view->zoom < 1)
+    {
+        p_view->zoom = 1;
+    }
+    if (p_view->follow || p_view->start + span > p_viz->num_samples)
+    {
+        p_view->start = (p_viz->num_samples > span) ? p_viz->num_samples - span : 0;
+    }
+}
+
+static void draw(const struct viz* p_viz, struct view* p_view, const char* p_name, int live, int fd)
+{
+	// the whole screen, a heading, a panel per coil and a time axis
+    static struct screen scr;
+    int panel_rows = (p_view->rows - 4) / 2;
+    size_t last = 0;
+    int32_t lo = 0;
+    int32_t hi = 0;
+    char text[256];
+
+    clamp_view(p_viz, p_view);
+    visible_scale(p_viz, p_view, &lo, &hi);
+    panel_rows = (panel_rows < 2) ? 2 : panel_rows;
+
+    scr.len = 0;
+    put(&scr, "");
+    if (p_view->colour)
+    {
+        put(&scr, "\x1b[H\x1b[2J");
+    }
+
+    last = p_view->start + (size_t)p_view->cols * p_view->zoom;
+    last = (last > p_viz->num_samples) ? p_viz->num_samples : last;
+    snprintf(text, sizeof(text), "%s  %zu samples  %.2f .. %.2f s  %zu per column  %.1f .. %.1f mV%s%s%s\n",
+             p_name, p_viz->num_samples,
+             p_viz->num_samples ? p_viz->p_samples[p_view->start].time_ms / 1000.0 : 0.0,
+             last ? p_viz->p_samples[last - 1].time_ms / 1000.0 : 0.0, p_view->zoom, lo / (double)q8_one,
+             hi / (double)q8_one, p_view->fixed_scale ? "  fixed" : "", p_view->follow ? "  follow" : "",
+             live ? "  live" : "");
+    put(&scr, text);
+
+    draw_panel(&scr, p_viz, p_view, 0, panel_rows, lo, hi);
+    draw_panel(&scr, p_viz, p_view, 1, panel_rows, lo, hi);
+
+    // time axis, a mark and the time in seconds every 20 columns
+    for (int x = 0; x < p_view->cols; x++)
+    {
+        size_t index = p_view->start + (size_t)x * p_view->zoom;
+
+        if (x % 20 == 0 && index < p_viz->num_samples && x + 8 < p_view->cols)
+        {
+            int len = snprintf(text, sizeof(text), "|%.2f", p_viz->p_samples[index].time_ms / 1000.0);
+
+            put(&scr, text);
+            x += len - 1;
+        }
+        else
+        {
+            put(&scr, " ");
+        }
+    }
+    put(&scr, "\n");
+
+    if (write(fd, scr.p_text, scr.len) < 0)
+    {
+        exit(1);
+    }
+}
+
+static struct termios saved_tty;
+static int tty_fd = -1;
+
+static void restore_tty(void)
+{
+    if (tty_fd >= 0)
+    {
+        tcsetattr(tty_fd, TCSAFLUSH, &saved_tty);
+        if (write(STDOUT_FILENO, "\x1b[?25h\x1b[?1049l", 14) < 0)
+        {
+            return;
+        }
+    }
+}
+
+static void on_signal(int sig)
+{
+    restore_tty();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+static int read_key(int fd)
+{
+	// a key press, with the arrow keys turned into h, j, k and l, or 0 if there is none
+    unsigned char key[8];
+    ssize_t got = read(fd, key, sizeof(key));
+
+    if (got <= 0)
+    {
+        return 0;
+    }
+    if (got >= 3 && key[0] == 0x1b && key[1] == '[')
+    {
+        switch (key[2])
+        {
+            case 'A': return 'k';
+            case 'B': return 'j';
+            case 'C': return 'l';
+            case 'D': return 'h';
+            case 'H': return 'g';
+            case 'F': return 'G';
+            default: return 0;
+        }
+    }
+
+    return key[0];
+}
+
+static void usage(const char* p_name)
+{
+    fprintf(stderr,
+        "usage: %s [options] [capture]\n"
+        "  capture                a UART capture or simulator output, standard input if not given\n"
+        "  --dump                 print one screen of the whole capture as text and exit\n"
+        "  --cols N, --rows N     screen size for --dump (120, 30)\n"
+        "  --zoom N               samples per column, the whole capture fits when not given\n"
+        "  --at S                 first time drawn in seconds with --dump\n"
+        "  --range LO,HI          fixed vertical scale in mV, automatic when not given\n",
+        p_name);
+    exit(2);
+}
+
+int main(int argc, char** argv)
+{
+    static struct viz viz;
+    struct view view = {0, 0, 1, 0, 0, 0, 120, 30, 0};
+    struct line_reader in = {STDIN_FILENO, 0, {0}, 0};
+    const char* p_name = "stdin";
+    int dump = 0;
+    double at_s = -1;
+    int redraw = 1;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char* p_opt = argv[i];
+        const char* p_arg = (i + 1 < argc) ? argv[i + 1] : NULL;
+        double lo = 0;
+        double hi = 0;
+
+        if (!strcmp(p_opt, "--dump"))
+        {
+            dump = 1;
+            continue;
+        }
+        if (p_opt[0] != '-')
+        {
+            p_name = p_opt;
+            in.fd = open(p_opt, O_RDONLY);
+            if (in.fd < 0)
+            {
+                perror(p_opt);
+                return 1;
+            }
+            continue;
+        }
+        if (p_arg == NULL)
+        {
+            usage(argv[0]);
+        }
+        i++;
+
+        if (!strcmp(p_opt, "--cols"))
+        {
+            view.cols = atoi(p_arg);
+        }
+        else if (!strcmp(p_opt, "--rows"))
+        {
+            view.rows = atoi(p_arg);
+        }
+        else if (!strcmp(p_opt, "--zoom"))
+        {
+            view.zoom = strtoul(p_arg, NULL, 0);
+        }
+        else if (!strcmp(p_opt, "--at"))
+        {
+            at_s = atof(p_arg);
+        }
+        else if (!strcmp(p_opt, "--range") && sscanf(p_arg, "%lf,%lf", &lo, &hi) == 2 && hi > lo)
+        {
+            view.fixed_scale = 1;
+            view.scale_lo = (int32_t)(lo * q8_one);
+            view.scale_hi = (int32_t)(hi * q8_one);
+        }
+        else
+        {
+            usage(argv[0]);
+        }
+    }
+    if (view.cols < 20 || view.rows < 10)
+    {
+        usage(argv[0]);
+    }
+
+    if (dump)
+    {
+        // a snapshot reads the whole capture first, then fits it to the screen or starts at --at
+        while (!in.done)
+        {
+            read_input(&viz, &in);
+        }
+        if (view.zoom == 0)
+        {
+            view.zoom = (viz.num_samples + view.cols - 1) / view.cols;
+        }
+        view.follow = 0;
+        while (at_s >= 0 && view.start < viz.num_samples && viz.p_samples[view.start].time_ms < at_s * 1000)
+        {
+            view.start++;
+        }
+        draw(&viz, &view, p_name, 0, STDOUT_FILENO);
+        return 0;
+    }
+
+    // keys come from the terminal, the samples may well be arriving on standard input
+    tty_fd = open("/dev/tty", O_RDONLY | O_NONBLOCK);
+    if (tty_fd < 0 || tcgetattr(tty_fd, &saved_tty) < 0)
+    {
+        fprintf(stderr, "no terminal to draw on, use --dump\n");
+        return 1;
+    }
+    else
+    {
+        struct termios raw = saved_tty;
+        struct winsize size;
+
+        raw.c_lflag &= ~(ICANON | ECHO);
+        raw.c_cc[VMIN] = 0;
+        raw.c_cc[VTIME] = 0;
+        tcsetattr(tty_fd, TCSAFLUSH, &raw);
+        atexit(restore_tty);
+        signal(SIGINT, on_signal);
+        signal(SIGTERM, on_signal);
+
+        if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_col >= 20 && size.ws_row >= 10)
+        {
+            view.cols = size.ws_col;
+            view.rows = size.ws_row;
+        }
+        if (write(STDOUT_FILENO, "\x1b[?1049h\x1b[?25l", 14) < 0)
+        {
+            return 1;
+        }
+    }
+    view.colour = 1;
+    view.zoom = view.zoom ? view.zoom : 1;
+    fcntl(in.fd, F_SETFL, fcntl(in.fd, F_GETFL) | O_NONBLOCK);
+
+    while (1)
+    {
+        struct pollfd fds[2] = {{tty_fd, POLLIN, 0}, {in.fd, POLLIN, 0}};
+        size_t page = (size_t)view.cols * view.zoom;
+        int key = 0;
+
+        if (redraw)
+        {
+            draw(&viz, &view, p_name, !in.done, STDOUT_FILENO);
+            redraw = 0;
+        }
+
+        // waits for a key or more input, and redraws a live stream at most 10 times a second
+        poll(fds, in.done ? 1 : 2, 100);
+        if (!in.done && read_input(&viz, &in))
+        {
+            redraw = 1;
+        }
+
+        while ((key = read_key(tty_fd)) != 0)
+        {
+            redraw = 1;
+            switch (key)
+            {
+                case 'q':
+                    return 0;
+                case 'h':
+                    view.follow = 0;
+                    view.start = (view.start > page / 4) ? view.start - page / 4 : 0;
+                    break;
+                case 'l':
+                    view.start += page / 4;
+                    break;
+                case 'k':
+                case '+':
+                    // zoom in around the middle of the screen
+                    if (view.zoom > 1)
+                    {
+                        view.start += page / 4;
+                        view.zoom /= 2;
+                    }
+                    break;
+                case 'j':
+                case '-':
+                    view.start = (view.start > page / 2) ? view.start - page / 2 : 0;
+                    view.zoom *= 2;
+                    break;
+                case 'g':
+                    view.follow = 0;
+                    view.start = 0;
+                    break;
+                case 'G':
+                case 'f':
+                    view.follow = (key == 'G') ? 1 : !view.follow;
+                    break;
+                case 'a':
+                    if (!view.fixed_scale)
+                    {
+                        // freezes the automatic scale where it is
+                        visible_scale(&viz, &view, &view.scale_lo, &view.scale_hi);
+                    }
+                    view.fixed_scale = !view.fixed_scale;
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+}
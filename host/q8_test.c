@@ -0,0 +1,400 @@
+// property test of the Q8 detection arithmetic. the saturating helpers are checked against 64 bit
+// references, and update_channel() against the uint16_t hysteresis it replaced, for every 12 bit
+// ADC reading over a grid of calibrations, thresholds and deadzones from every coil state. it is
+// then timed for every 12 bit reading from every coil state, and the paths those take through the
+// old code should not be told apart by the branch free version. exits with 1 on any mismatch, or
+// when the slowest path is over the time budget or too far from the fastest.
+//
+// build from the repository root:
+//   cc -O2 -DHOST_SIM -Ihost host/q8_test.c host/host_hw.c -lm -o q8_test
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define test_has_tsc 1
+#else
+#include <time.h>
+#define test_has_tsc 0
+#endif
+
+// the firmware is built into the test whole, for the static inline helpers
+#include "../helloworld.c"
+#undef main
+
+static uint64_t test_random_state = 0x2545F4914F6CDD1Dull;
+
+static uint32_t test_random(void)
+{
+    test_random_state ^= test_random_state << 13;
+    test_random_state ^= test_random_state >> 7;
+    test_random_state ^= test_random_state << 17;
+    return (uint32_t)(test_random_state >> 16);
+}
+
+static uint64_t test_cycles(void)
+{
+#if test_has_tsc
+    return __rdtsc();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+static q8_t saturate(int64_t value)
+{
+    return (value > INT32_MAX) ? INT32_MAX : ((value < INT32_MIN) ? INT32_MIN : (q8_t)value);
+}
+
+static long check_helpers(q8_t a, q8_t b)
+{
+	// mismatches of every helper on one pair of inputs
+    long errors = 0;
+
+    errors += q8_add(a, b) != saturate((int64_t)a + b);
+    errors += q8_sub(a, b) != saturate((int64_t)a - b);
+    errors += q8_gt(a, b) != (a > b);
+    errors += q8_max0(a) != ((a < 0) ? 0 : a);
+
+    if (errors)
+    {
+        printf("  mismatch at a = %ld, b = %ld\n", (long)a, (long)b);
+    }
+
+    return errors;
+}
+
+static long test_helpers(void)
+{
+	// every pair from the saturation edges, then random pairs over the whole range and over the
+	// range real drops and thresholds fall in
+    static const q8_t edges[] =
+    {
+        INT32_MIN, INT32_MIN + 1, INT32_MIN / 2, -65536 * 256, -256, -1, 0, 1, 255, 256,
+        65535 * 256, INT32_MAX / 2, INT32_MAX - 1, INT32_MAX,
+    };
+    int num_edges = sizeof(edges) / sizeof(edges[0]);
+    long errors = 0;
+    long pairs = 0;
+
+    for (int i = 0; i < num_edges; i++)
+    {
+        for (int j = 0; j < num_edges; j++)
+        {
+            errors += check_helpers(edges[i], edges[j]);
+            pairs++;
+        }
+    }
+
+    for (long i = 0; i < 20000000; i++)
+    {
+        q8_t a = (q8_t)test_random() ^ (q8_t)(test_random() << 16);
+        q8_t b = (i & 1) ? (q8_t)test_random() ^ (q8_t)(test_random() << 16) : (q8_t)(test_random() % 0x200000) - 0x100000;
+
+        errors += check_helpers(a, b);
+        pairs++;
+    }
+
+    printf("q8_add, q8_sub, q8_gt, q8_max0: %ld pairs, %ld mismatches\n", pairs, errors);
+
+    return errors;
+}
+
+static void old_channel(_Bool* p_digital, _Bool* p_close, uint16_t adc_val, uint16_t adc_cal, uint16_t threshold,
+                        uint16_t close, uint16_t deadzone)
+{
+	// the hysteresis main() ran for each coil before update_channel(), as it was, uint16_t
+	// operands promoted to int
+    if (*p_digital)
+    {
+        if (!*p_close)
+        {
+            if (adc_val > (adc_cal - threshold + deadzone / 2))
+            {
+                *p_digital = false;
+            }
+            else if (adc_val < (adc_cal - close - deadzone / 2))
+            {
+                *p_close = true;
+            }
+        }
+        else
+        {
+            if (adc_val > (adc_cal - close + deadzone / 2))
+            {
+                *p_close = false;
+            }
+        }
+    }
+    else
+    {
+        if (adc_val < (adc_cal - threshold - deadzone / 2))
+        {
+            *p_digital = true;
+        }
+    }
+}
+
+static long test_update_channel(void)
+{
+	// update_channel() takes half the deadzone in Q8, so an odd deadzone puts the edges half a mV
+	// further out than the old deadzone / 2 did. the old code runs in half mV here, where its
+	// deadzone / 2 is exact, which for even deadzones is the same as running it in mV.
+    static const uint16_t cals[] = {0, 120, 500, 800, 999};
+    static const uint16_t deadzones[] = {0, 1, 2, 7, 30, 31, 60, 200};
+    static const _Bool states[3][2] = {{false, false}, {true, false}, {true, true}};
+    long errors = 0;
+    long cases = 0;
+
+    for (size_t c = 0; c < sizeof(cals) / sizeof(cals[0]); c++)
+    {
+        for (uint16_t threshold = 0; threshold <= 1000; threshold += 50)
+        {
+            for (uint16_t close = 0; close <= 1000; close += 50)
+            {
+                for (size_t d = 0; d < sizeof(deadzones) / sizeof(deadzones[0]); d++)
+                {
+                    uint16_t deadzone = deadzones[d];
+
+                    for (int code = 0; code < 4096; code++)
+                    {
+                        uint16_t adc_val = adc_to_mv(code << 4);
+                        q8_t drop = q8_sub(q8_from_mv(cals[c]), q8_from_mv(adc_val));
+
+                        for (int s = 0; s < 3; s++)
+                        {
+                            _Bool digital = states[s][0];
+                            _Bool is_close = states[s][1];
+                            struct detect_channel chan = {states[s][0], states[s][1]};
+
+                            old_channel(&digital, &is_close, 2 * adc_val, 2 * cals[c], 2 * threshold, 2 * close, 2 * deadzone);
+                            update_channel(&chan, drop, q8_from_mv(threshold), q8_from_mv(close), deadzone * 128);
+                            cases++;
+
+                            if (chan.detected != digital || chan.close != is_close)
+                            {
+                                if (errors++ < 10)
+                                {
+                                    printf("  mismatch: reading %u cal %u threshold %u close %u deadzone %u from %d%d, "
+                                           "old %d%d new %d%d\n", adc_val, cals[c], threshold, close, deadzone,
+                                           states[s][0], states[s][1], digital, is_close, chan.detected, chan.close);
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    printf("update_channel against the old hysteresis: %ld cases, %ld mismatches\n", cases, errors);
+
+    return errors;
+}
+
+// update_channel() is timed for every 12 bit reading from every coil state, in batches of calls
+// from which each input keeps its fastest over all the rounds, so an interrupt or a clock ramp in
+// one batch is not mistaken for a slow path.
+#define test_timed_batch 64
+#define test_timed_rounds 40
+
+// the inputs are grouped by the path they took through the old code, the state they start in and
+// the state they end in, and each path is represented by the median of its inputs. the slowest
+// path may take at most this many TSC cycles (nS without a TSC) per call, call through a pointer
+// included, and may be at most this far over the fastest path.
+#define test_budget_per_call 64
+#define test_max_spread_percent 10
+
+// calibration and levels the readings are timed against, with a close level so every path is
+// among them, and inputs that saturate every operand from every state
+#define test_timed_cal_mv 800
+#define test_timed_detect_mv 50
+#define test_timed_close_mv 100
+#define test_timed_deadzone_mv 30
+#define test_timed_readings (3 * 4096)
+#define test_timed_saturating 64
+#define test_timed_inputs (test_timed_readings + 3 * test_timed_saturating)
+
+// the 7 paths through the old code, and the saturating inputs
+#define test_num_paths 8
+
+static const char* const path_names[test_num_paths] =
+{
+    "stays ndet", "ndet to far", "far to ndet", "stays far", "far to close", "close to far", "stays close",
+    "saturating",
+};
+
+// inputs of one timed call, and a function pointer so the compiler cannot fold the calls
+struct timed_input
+{
+    q8_t drop;
+    q8_t detect;
+    q8_t close;
+    q8_t half_deadzone;
+    struct detect_channel from;
+};
+
+static void (*volatile p_update)(struct detect_channel*, q8_t, q8_t, q8_t, q8_t) = update_channel;
+
+static double time_update(const struct timed_input* p_in)
+{
+	// cycles per update_channel() call over one batch from one state and input. the input is
+	// copied next to the state first, so where it sits in the table cannot change the timing.
+    struct timed_input in = *p_in;
+    struct detect_channel chan;
+    uint64_t start = test_cycles();
+
+    for (int i = 0; i < test_timed_batch; i++)
+    {
+        chan = in.from;
+        p_update(&chan, in.drop, in.detect, in.close, in.half_deadzone);
+    }
+
+    return (double)(test_cycles() - start) / test_timed_batch;
+}
+
+static int path_of(const struct timed_input* p_in)
+{
+	// which of the old code's paths an input takes, from where it starts and ends up
+    struct detect_channel chan = p_in->from;
+    int from = p_in->from.detected + p_in->from.close;
+    int to = 0;
+
+    update_channel(&chan, p_in->drop, p_in->detect, p_in->close, p_in->half_deadzone);
+    to = chan.detected + chan.close;
+
+    // ndet goes to 0 or 1, far to 2, 3 or 4, close to 5 or 6
+    return (from == 0) ? to : ((from == 1) ? 2 + to : 4 + to);
+}
+
+static int compare_cycles(const void* p_a, const void* p_b)
+{
+    double a = *(const double*)p_a;
+    double b = *(const double*)p_b;
+
+    return (a > b) - (a < b);
+}
+
+static long test_timing(void)
+{
+	// times every reading from every state against one set of levels, which between them take
+	// every path through the old code. returns 1 when the slowest path is over budget or too far
+	// from the fastest.
+    static const struct detect_channel states[3] = {{false, false}, {true, false}, {true, true}};
+    static struct timed_input inputs[test_timed_inputs];
+    static double cycles[test_timed_inputs];
+    static double path_cycles[test_timed_inputs];
+    static int order[test_timed_inputs];
+    double medians[test_num_paths];
+    int slowest = -1;
+    int fastest = -1;
+    double spread = 0;
+    long failed = 0;
+
+    for (int s = 0; s < 3; s++)
+    {
+        for (int code = 0; code < 4096; code++)
+        {
+            struct timed_input* p_in = &inputs[s * 4096 + code];
+
+            p_in->drop = q8_sub(q8_from_mv(test_timed_cal_mv), q8_from_mv(adc_to_mv(code << 4)));
+            p_in->detect = q8_from_mv(test_timed_detect_mv);
+            p_in->close = q8_from_mv(test_timed_close_mv);
+            p_in->half_deadzone = test_timed_deadzone_mv * 128;
+            p_in->from = states[s];
+        }
+
+        // drops and levels at both ends of the range, so every add and subtract saturates
+        for (int k = 0; k < test_timed_saturating / 2; k++)
+        {
+            struct timed_input* p_in = &inputs[test_timed_readings + s * test_timed_saturating + 2 * k];
+
+            p_in[0] = (struct timed_input){INT32_MIN + k, INT32_MAX - k, INT32_MAX - k, INT32_MAX - k, states[s]};
+            p_in[1] = (struct timed_input){INT32_MAX - k, INT32_MIN + k, INT32_MIN + k, INT32_MAX - k, states[s]};
+        }
+    }
+
+    for (int i = 0; i < test_timed_inputs; i++)
+    {
+        order[i] = i;
+    }
+
+    // each round visits the inputs in a new order, so a stretch of slow host lands on inputs
+    // of every path rather than on a run of readings that all take the same one
+    for (int round = 0; round < test_timed_rounds; round++)
+    {
+        for (int i = test_timed_inputs - 1; i > 0; i--)
+        {
+            int j = test_random() % (i + 1);
+            int swap = order[i];
+
+            order[i] = order[j];
+            order[j] = swap;
+        }
+
+        for (int i = 0; i < test_timed_inputs; i++)
+        {
+            double batch = time_update(&inputs[order[i]]);
+            cycles[order[i]] = (round == 0 || batch < cycles[order[i]]) ? batch : cycles[order[i]];
+        }
+    }
+
+    for (int path = 0; path < test_num_paths; path++)
+    {
+        int count = 0;
+
+        for (int i = 0; i < test_timed_inputs; i++)
+        {
+            if ((i < test_timed_readings) ? path_of(&inputs[i]) == path : path == test_num_paths - 1)
+            {
+                path_cycles[count++] = cycles[i];
+            }
+        }
+
+        if (count == 0)
+        {
+            printf("  no reading takes the path %s\n", path_names[path]);
+            failed = 1;
+            medians[path] = 0;
+            continue;
+        }
+
+        qsort(path_cycles, count, sizeof(path_cycles[0]), compare_cycles);
+        medians[path] = path_cycles[count / 2];
+        slowest = (slowest < 0 || medians[path] > medians[slowest]) ? path : slowest;
+        fastest = (fastest < 0 || medians[path] < medians[fastest]) ? path : fastest;
+        printf("  %-13s %5d inputs, median %.2f, fastest %.2f\n", path_names[path], count, medians[path],
+               path_cycles[0]);
+    }
+
+    if (slowest >= 0)
+    {
+        spread = 100.0 * (medians[slowest] - medians[fastest]) / medians[fastest];
+        failed |= medians[slowest] > test_budget_per_call || spread > test_max_spread_percent;
+        printf("update_channel over %d inputs, every reading from every state: %s slowest at %.2f %s per call, "
+               "%s fastest, spread %.1f%%, budget %d and %d%%  %s\n", test_timed_inputs, path_names[slowest],
+               medians[slowest], test_has_tsc ? "TSC cycles" : "nS", path_names[fastest], spread,
+               test_budget_per_call, test_max_spread_percent, failed ? "FAILED" : "ok");
+    }
+
+    return failed;
+}
+
+int main(void)
+{
+    long errors = 0;
+
+    errors += test_helpers();
+    errors += test_update_channel();
+    errors += test_timing();
+
+    printf("%s\n", errors ? "FAILED" : "passed");
+
+    return errors ? 1 : 0;
+}
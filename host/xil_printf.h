@@ -0,0 +1,9 @@
+// host stand in for the Xilinx BSP header, telemetry goes to stdout
+#ifndef XIL_PRINTF_H
+#define XIL_PRINTF_H
+
+#include <stdio.h>
+
+#define xil_printf printf
+
+#endif